@@ -0,0 +1,800 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* librpprefapps - catalog loading, name and ID matching and install set computation, without GTK */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <locale.h>
+#include <sys/utsname.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "prefapps.h"
+
+/* Saved update status, in the system cache directory with the fragment cache */
+
+#define UPDATES_CACHE       "updates"
+#define APT_LISTS_DIR       "/var/lib/apt/lists"
+#define DPKG_STATUS         "/var/lib/dpkg/status"
+
+static const gchar *catalog_keys[CF_NUM_FIELDS] = CATALOG_KEYS;
+
+/* Where the catalog, local fragments and caches are found - the installed locations unless changed by prefapps_set_dirs */
+
+static const gchar *data_dir = PACKAGE_DATA_DIR;
+static const gchar *sysconf_dir = PACKAGE_SYSCONF_DIR;
+static const gchar *cache_dir = PACKAGE_CACHE_DIR;
+
+static gboolean catalog_stale (const gchar *loc);
+static const gchar *catalog_str (const gchar *base, const CatalogHeader *hdr, guint32 off);
+static gboolean load_catalog (const gchar *loc, GMappedFile **map, GPtrArray *entries, GHashTable *index);
+static gboolean load_text (const gchar *loc, GStringChunk *chunk, GPtrArray *entries, GHashTable *index);
+static GVariant *load_fragment (const gchar *path);
+static void load_fragments (GStringChunk *chunk, GPtrArray *entries, GHashTable *index);
+static void merge_entries (GVariant *list, GStringChunk *chunk, GPtrArray *entries, GHashTable *index, gboolean override);
+static void add_language (GPtrArray *langs, const gchar *lang);
+static gboolean updates_stamp (gint64 *lists, gint64 *status);
+
+/* Machine name from uname (), read once, for matching arch= expressions */
+
+static gchar *machine;
+static gsize machine_init;
+
+/*----------------------------------------------------------------------------*/
+/* Catalog loading                                                            */
+/*----------------------------------------------------------------------------*/
+
+void prefapps_set_dirs (const gchar *data, const gchar *sysconf, const gchar *cache)
+{
+    data_dir = data;
+    sysconf_dir = sysconf;
+    cache_dir = cache;
+}
+
+Catalog *prefapps_catalog_load (const gchar *loc)
+{
+    Catalog *cat;
+    GHashTable *index;
+    gchar *buf;
+
+    buf = g_strdup (loc ? loc : setlocale (0, ""));
+    strtok (buf, "_. ");
+
+    // use the compiled catalog unless it is missing or older than the text files, which may have been edited locally
+    cat = g_new0 (Catalog, 1);
+    cat->strings = g_string_chunk_new (4096);
+    cat->entries = g_ptr_array_new_with_free_func (g_free);
+    index = g_hash_table_new (g_str_hash, g_str_equal);
+    if (!load_catalog (buf, &cat->map, cat->entries, index) && !load_text (buf, cat->strings, cat->entries, index))
+    {
+        g_hash_table_destroy (index);
+        prefapps_catalog_free (cat);
+        g_free (buf);
+        return NULL;
+    }
+
+    // local entries override or extend the system ones
+    load_fragments (cat->strings, cat->entries, index);
+    g_hash_table_destroy (index);
+    g_free (buf);
+    return cat;
+}
+
+gchar **prefapps_catalog_languages (void)
+{
+    GPtrArray *langs;
+    GMappedFile *map;
+    GDir *dir;
+    const CatalogHeader *hdr;
+    const CatalogLocale *locs;
+    const gchar *base, *name;
+    gchar *buf;
+    gsize len, nloc;
+    int i;
+
+    langs = g_ptr_array_new ();
+
+    // the languages with overlays in the compiled catalog...
+    buf = g_build_filename (data_dir, CATALOG_FILE, NULL);
+    map = g_mapped_file_new (buf, FALSE, NULL);
+    g_free (buf);
+    if (map)
+    {
+        base = g_mapped_file_get_contents (map);
+        len = g_mapped_file_get_length (map);
+        hdr = (const CatalogHeader *) base;
+        if (len >= sizeof (CatalogHeader) && !memcmp (hdr->magic, CATALOG_MAGIC, 8)
+            && GUINT32_FROM_LE (hdr->strings) + GUINT32_FROM_LE (hdr->strings_len) <= len
+            && GUINT32_FROM_LE (hdr->strings_len) && !base[GUINT32_FROM_LE (hdr->strings) + GUINT32_FROM_LE (hdr->strings_len) - 1])
+        {
+            nloc = GUINT32_FROM_LE (hdr->n_locales);
+            locs = (const CatalogLocale *) (base + GUINT32_FROM_LE (hdr->locales));
+            if (GUINT32_FROM_LE (hdr->locales) + nloc * sizeof (CatalogLocale) <= len)
+                for (i = 0; i < nloc; i++) add_language (langs, catalog_str (base, hdr, locs[i].lang));
+        }
+        g_mapped_file_unref (map);
+    }
+
+    // ...and any translated data files beside it, which are used if the catalog is out of date
+    dir = g_dir_open (data_dir, 0, NULL);
+    if (dir)
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            if (!g_str_has_prefix (name, "prefapps_") || !g_str_has_suffix (name, ".conf")) continue;
+            buf = g_strndup (name + 9, strlen (name) - 14);
+            add_language (langs, buf);
+            g_free (buf);
+        }
+        g_dir_close (dir);
+    }
+
+    g_ptr_array_add (langs, NULL);
+    return (gchar **) g_ptr_array_free (langs, FALSE);
+}
+
+static void add_language (GPtrArray *langs, const gchar *lang)
+{
+    int i;
+
+    if (!lang || !*lang) return;
+    for (i = 0; i < langs->len; i++)
+        if (!g_strcmp0 (g_ptr_array_index (langs, i), lang)) return;
+    g_ptr_array_add (langs, g_strdup (lang));
+}
+
+void prefapps_catalog_free (Catalog *cat)
+{
+    if (!cat) return;
+    g_ptr_array_free (cat->entries, TRUE);
+    g_string_chunk_free (cat->strings);
+    if (cat->map) g_mapped_file_unref (cat->map);
+    g_free (cat);
+}
+
+static gboolean catalog_stale (const gchar *loc)
+{
+    GStatBuf cat, txt;
+    gchar *buf;
+    gboolean ret = FALSE;
+
+    buf = g_build_filename (data_dir, CATALOG_FILE, NULL);
+    if (g_stat (buf, &cat)) ret = TRUE;
+    g_free (buf);
+    if (ret) return TRUE;
+    buf = g_build_filename (data_dir, "prefapps.conf", NULL);
+    if (!g_stat (buf, &txt) && txt.st_mtime > cat.st_mtime) ret = TRUE;
+    g_free (buf);
+    buf = g_strdup_printf ("%s/prefapps_%s.conf", data_dir, loc);
+    if (!g_stat (buf, &txt) && txt.st_mtime > cat.st_mtime) ret = TRUE;
+    g_free (buf);
+    return ret;
+}
+
+static const gchar *catalog_str (const gchar *base, const CatalogHeader *hdr, guint32 off)
+{
+    off = GUINT32_FROM_LE (off);
+    if (!off || off >= GUINT32_FROM_LE (hdr->strings_len)) return NULL;
+    return base + GUINT32_FROM_LE (hdr->strings) + off;
+}
+
+static gboolean load_catalog (const gchar *loc, GMappedFile **map, GPtrArray *entries, GHashTable *index)
+{
+    const gchar *base, *str;
+    gchar *buf;
+    const CatalogHeader *hdr;
+    const CatalogEntry *ents, *over = NULL;
+    const CatalogLocale *locs;
+    CatEntry *e;
+    gsize len, nent, nloc, strs, slen;
+    int i, f;
+
+    if (catalog_stale (loc)) return FALSE;
+    buf = g_build_filename (data_dir, CATALOG_FILE, NULL);
+    *map = g_mapped_file_new (buf, FALSE, NULL);
+    g_free (buf);
+    if (!*map) return FALSE;
+
+    // check that the header and tables lie within the file before using any of them
+    base = g_mapped_file_get_contents (*map);
+    len = g_mapped_file_get_length (*map);
+    hdr = (const CatalogHeader *) base;
+    if (len < sizeof (CatalogHeader) || memcmp (hdr->magic, CATALOG_MAGIC, 8))
+    {
+        g_mapped_file_unref (*map);
+        *map = NULL;
+        return FALSE;
+    }
+    nent = GUINT32_FROM_LE (hdr->n_entries);
+    nloc = GUINT32_FROM_LE (hdr->n_locales);
+    strs = GUINT32_FROM_LE (hdr->strings);
+    slen = GUINT32_FROM_LE (hdr->strings_len);
+    if (strs + slen > len || !slen || base[strs + slen - 1]
+        || GUINT32_FROM_LE (hdr->entries) + nent * sizeof (CatalogEntry) > len
+        || GUINT32_FROM_LE (hdr->locales) + nloc * sizeof (CatalogLocale) > len)
+    {
+        g_mapped_file_unref (*map);
+        *map = NULL;
+        return FALSE;
+    }
+    ents = (const CatalogEntry *) (base + GUINT32_FROM_LE (hdr->entries));
+    locs = (const CatalogLocale *) (base + GUINT32_FROM_LE (hdr->locales));
+
+    // find the overlay for the current language, if there is one
+    for (i = 0; i < nloc; i++)
+    {
+        if (!g_strcmp0 (catalog_str (base, hdr, locs[i].lang), loc)
+            && GUINT32_FROM_LE (locs[i].overlay) + nent * sizeof (CatalogEntry) <= len)
+        {
+            over = (const CatalogEntry *) (base + GUINT32_FROM_LE (locs[i].overlay));
+            break;
+        }
+    }
+
+    // the strings are used in place, so the file stays mapped for as long as the catalog generation
+    for (i = 0; i < nent; i++)
+    {
+        e = g_new0 (CatEntry, 1);
+        for (f = 0; f < CF_NUM_FIELDS; f++)
+        {
+            str = over ? catalog_str (base, hdr, over[i].field[f]) : NULL;
+            e->str[f] = str ? str : catalog_str (base, hdr, ents[i].field[f]);
+        }
+        e->flags = GUINT32_FROM_LE (ents[i].flags);
+        if (!e->str[CF_PACKAGE])
+        {
+            g_free (e);
+            continue;
+        }
+        g_hash_table_insert (index, (gpointer) e->str[CF_PACKAGE], GUINT_TO_POINTER (entries->len + 1));
+        g_ptr_array_add (entries, e);
+    }
+    return TRUE;
+}
+
+static gboolean load_text (const gchar *loc, GStringChunk *chunk, GPtrArray *entries, GHashTable *index)
+{
+    GVariant *list;
+    gchar *buf;
+
+    buf = g_strdup_printf ("%s/prefapps_%s.conf", data_dir, loc);
+    list = prefapps_parse_conf (buf, NULL);
+    g_free (buf);
+    if (!list)
+    {
+        buf = g_build_filename (data_dir, "prefapps.conf", NULL);
+        list = prefapps_parse_conf (buf, NULL);
+        g_free (buf);
+    }
+    if (!list) return FALSE;
+
+    merge_entries (list, chunk, entries, index, FALSE);
+    g_variant_unref (list);
+    return TRUE;
+}
+
+GVariant *prefapps_parse_conf (const gchar *path, GError **error)
+{
+    GKeyFile *kf;
+    GVariantBuilder list, dict;
+    gchar **groups, **keys, *val;
+    int i, j;
+
+    // read a data file as a list of group names and dictionaries, holding the keys which are present
+    kf = g_key_file_new ();
+    if (!g_key_file_load_from_file (kf, path, G_KEY_FILE_NONE, error))
+    {
+        g_key_file_free (kf);
+        return NULL;
+    }
+
+    g_variant_builder_init (&list, G_VARIANT_TYPE ("a(sa{ss})"));
+    groups = g_key_file_get_groups (kf, NULL);
+    for (i = 0; groups[i]; i++)
+    {
+        g_variant_builder_init (&dict, G_VARIANT_TYPE ("a{ss}"));
+        keys = g_key_file_get_keys (kf, groups[i], NULL, NULL);
+        for (j = 0; keys && keys[j]; j++)
+        {
+            val = g_key_file_get_value (kf, groups[i], keys[j], NULL);
+            if (val) g_variant_builder_add (&dict, "{ss}", keys[j], val);
+            g_free (val);
+        }
+        g_strfreev (keys);
+        g_variant_builder_add (&list, "(s@a{ss})", groups[i], g_variant_builder_end (&dict));
+    }
+    g_strfreev (groups);
+    g_key_file_free (kf);
+    return g_variant_ref_sink (g_variant_builder_end (&list));
+}
+
+static GVariant *load_fragment (const gchar *path)
+{
+    GStatBuf st;
+    GMappedFile *map;
+    GVariant *cache, *list = NULL;
+    gchar *base, *cpath;
+    gint64 mtime, size;
+
+    if (g_stat (path, &st)) return NULL;
+
+    // each fragment has its own cache file, named after it
+    base = g_path_get_basename (path);
+    cpath = g_strdup_printf ("%s/conf.d/%s.cache", cache_dir, base);
+    g_free (base);
+
+    // the cache holds the fragment's modification time and size, followed by its parsed entries
+    map = g_mapped_file_new (cpath, FALSE, NULL);
+    if (map)
+    {
+        cache = g_variant_new_from_data (G_VARIANT_TYPE ("(xxa(sa{ss}))"), g_mapped_file_get_contents (map),
+            g_mapped_file_get_length (map), FALSE, (GDestroyNotify) g_mapped_file_unref, map);
+        g_variant_ref_sink (cache);
+        g_variant_get (cache, "(xx@a(sa{ss}))", &mtime, &size, &list);
+        if (mtime != st.st_mtime || size != st.st_size)
+        {
+            g_variant_unref (list);
+            list = NULL;
+        }
+        g_variant_unref (cache);
+    }
+
+    if (!list)
+    {
+        list = prefapps_parse_conf (path, NULL);
+        if (list)
+        {
+            cache = g_variant_ref_sink (g_variant_new ("(xx@a(sa{ss}))", (gint64) st.st_mtime, (gint64) st.st_size, list));
+            base = g_path_get_dirname (cpath);
+            g_mkdir_with_parents (base, 0755);
+            g_file_set_contents (cpath, g_variant_get_data (cache), g_variant_get_size (cache), NULL);
+            g_free (base);
+            g_variant_unref (cache);
+        }
+    }
+
+    g_free (cpath);
+    return list;
+}
+
+static void load_fragments (GStringChunk *chunk, GPtrArray *entries, GHashTable *index)
+{
+    GDir *dir;
+    GList *files = NULL, *l;
+    GVariant *list;
+    const gchar *name;
+    gchar *path, *dpath;
+
+    // fragments are applied in name order, so later files take precedence over earlier ones
+    dpath = g_build_filename (sysconf_dir, "conf.d", NULL);
+    dir = g_dir_open (dpath, 0, NULL);
+    if (!dir)
+    {
+        g_free (dpath);
+        return;
+    }
+    while ((name = g_dir_read_name (dir)))
+        if (g_str_has_suffix (name, ".conf")) files = g_list_prepend (files, g_strdup (name));
+    g_dir_close (dir);
+    files = g_list_sort (files, (GCompareFunc) strcmp);
+
+    for (l = files; l; l = l->next)
+    {
+        path = g_build_filename (dpath, l->data, NULL);
+        list = load_fragment (path);
+        if (list)
+        {
+            merge_entries (list, chunk, entries, index, TRUE);
+            g_variant_unref (list);
+        }
+        g_free (path);
+    }
+    g_list_free_full (files, g_free);
+    g_free (dpath);
+}
+
+static void merge_entries (GVariant *list, GStringChunk *chunk, GPtrArray *entries, GHashTable *index, gboolean override)
+{
+    GVariantIter iter;
+    GVariant *dict;
+    CatEntry *e;
+    const gchar *group, *val;
+    guint pos;
+    int f;
+
+    // An entry in a fragment replaces any earlier entry for the same package, in the same position in the list;
+    // keys not given in the fragment keep their earlier values, so an entry can be hidden or recategorised
+    // with just package= and the changed keys
+    g_variant_iter_init (&iter, list);
+    while (g_variant_iter_next (&iter, "(&s@a{ss})", &group, &dict))
+    {
+        if (!g_variant_lookup (dict, "package", "&s", &val))
+        {
+            g_variant_unref (dict);
+            continue;
+        }
+
+        e = g_new0 (CatEntry, 1);
+        pos = override ? GPOINTER_TO_UINT (g_hash_table_lookup (index, val)) : 0;
+        if (pos) *e = *((CatEntry *) g_ptr_array_index (entries, pos - 1));
+
+        if (!pos) e->str[CF_GROUP] = g_string_chunk_insert_const (chunk, group);
+        for (f = CF_CATEGORY; f < CF_NUM_FIELDS; f++)
+            if (g_variant_lookup (dict, catalog_keys[f], "&s", &val)) e->str[f] = g_string_chunk_insert_const (chunk, val);
+        if (g_variant_lookup (dict, "reboot", "&s", &val)) e->flags = prefapps_conf_bool (val) ? e->flags | CATALOG_REBOOT : e->flags & ~CATALOG_REBOOT;
+        if (g_variant_lookup (dict, "rpdesc", "&s", &val)) e->flags = prefapps_conf_bool (val) ? e->flags | CATALOG_RPDESC : e->flags & ~CATALOG_RPDESC;
+        if (g_variant_lookup (dict, "hidden", "&s", &val)) e->flags = prefapps_conf_bool (val) ? e->flags | ENTRY_HIDDEN : e->flags & ~ENTRY_HIDDEN;
+
+        if (pos)
+        {
+            g_free (g_ptr_array_index (entries, pos - 1));
+            g_ptr_array_index (entries, pos - 1) = e;
+        }
+        else
+        {
+            g_ptr_array_add (entries, e);
+            pos = entries->len;
+        }
+        g_hash_table_insert (index, (gpointer) e->str[CF_PACKAGE], GUINT_TO_POINTER (pos));
+        g_variant_unref (dict);
+    }
+}
+
+gboolean prefapps_conf_bool (const gchar *val)
+{
+    return !g_ascii_strcasecmp (val, "true") || !g_strcmp0 (val, "1");
+}
+
+void prefapps_entry_names (Catalog *cat, const CatEntry *e, const gchar *lang, const gchar *lang_loc, GPtrArray *pnames)
+{
+    gchar **addl;
+    const gchar *adds = e->str[CF_ADDITIONAL];
+    int i;
+
+    // add package names, and any additional packages, to array of names to resolve
+    g_ptr_array_add (pnames, (gpointer) e->str[CF_PACKAGE]);
+    if (e->str[CF_RPACKAGE]) g_ptr_array_add (pnames, (gpointer) e->str[CF_RPACKAGE]);
+    if (adds && *adds)
+    {
+        addl = prefapps_expand_additional (adds, lang, lang_loc);
+        for (i = 0; addl[i]; i++) g_ptr_array_add (pnames, g_string_chunk_insert_const (cat->strings, addl[i]));
+        g_strfreev (addl);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Package names and IDs                                                      */
+/*----------------------------------------------------------------------------*/
+
+gboolean prefapps_match_pid (const char *name, const char *pid)
+{
+    char *buf;
+    gboolean ret = FALSE;
+
+    if (name == NULL) return FALSE;
+    buf = g_strdup (pid);
+    g_strdelimit (buf, ";", 0);
+    if (!g_strcmp0 (buf, name)) ret = TRUE;
+    g_free (buf);
+    return ret;
+}
+
+gchar **prefapps_expand_additional (const gchar *adds, const gchar *lang, const gchar *lang_loc)
+{
+    GPtrArray *names;
+    gchar **list;
+    int i;
+
+    // additional packages are separated by commas, with %s substituted by each of the locale strings
+    names = g_ptr_array_new ();
+    list = g_strsplit (adds, ",", -1);
+    for (i = 0; list[i]; i++)
+    {
+        if (!*list[i]) continue;
+        if (strchr (list[i], '%'))
+        {
+            if (lang && *lang) g_ptr_array_add (names, g_strdup_printf (list[i], lang));
+            if (lang_loc && *lang_loc) g_ptr_array_add (names, g_strdup_printf (list[i], lang_loc));
+        }
+        else g_ptr_array_add (names, g_strdup (list[i]));
+    }
+    g_strfreev (list);
+    g_ptr_array_add (names, NULL);
+    return (gchar **) g_ptr_array_free (names, FALSE);
+}
+
+gboolean prefapps_valid_name (const gchar *name)
+{
+    // Debian package names - lower case alphanumerics, plus, minus and dot
+    if (!name || !*name) return FALSE;
+    for (; *name; name++)
+        if (!g_ascii_islower (*name) && !g_ascii_isdigit (*name) && !strchr ("+-.", *name)) return FALSE;
+    return TRUE;
+}
+
+gboolean prefapps_match_arch (const char *arch)
+{
+    struct utsname un;
+    gchar *expr, **alts;
+    int len, i;
+    gboolean ret = FALSE;
+
+    if (!g_strcmp0 (arch, "any")) return TRUE;
+    if (g_once_init_enter (&machine_init))
+    {
+        machine = g_strdup (uname (&un) ? "" : un.machine);
+        g_once_init_leave (&machine_init, 1);
+    }
+
+    // arch expressions are a grep pattern of alternatives, e.g. "armv7l\|aarch64", optionally quoted, any of which
+    // may appear anywhere in the machine name
+    len = strlen (arch);
+    if (len >= 2 && arch[0] == '"' && arch[len - 1] == '"') expr = g_strndup (arch + 1, len - 2);
+    else expr = g_strdup (arch);
+
+    alts = g_strsplit (expr, "\\|", -1);
+    for (i = 0; alts[i] && !ret; i++)
+        if (strstr (machine, alts[i])) ret = TRUE;
+    g_strfreev (alts);
+    g_free (expr);
+    return ret;
+}
+
+void prefapps_get_locales (gchar **lang, gchar **lang_loc)
+{
+    char *lstring = setlocale (LC_CTYPE, NULL);
+    if (lstring && *lstring)
+    {
+        char *lastr = strtok (lstring, "_");
+        char *lostr = strtok (NULL, ". ");
+        if (lastr && *lastr)
+        {
+            *lang = g_strdup (lastr);
+            if (lostr && *lostr)
+            {
+                char *str = g_ascii_strdown (lostr, -1);
+                *lang_loc = g_strdup_printf ("%s-%s", *lang, str);
+                g_free (str);
+            }
+            else *lang_loc = g_strdup ("");
+        }
+        else
+        {
+            *lang = g_strdup ("");
+            *lang_loc = g_strdup ("");
+        }
+    }
+    else
+    {
+        *lang = g_strdup ("");
+        *lang_loc = g_strdup ("");
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Choosing packages                                                          */
+/*----------------------------------------------------------------------------*/
+
+GHashTable *prefapps_best_ids (GPtrArray *packages)
+{
+    PkPackage *item;
+    PkInfoEnum info;
+    GHashTable *best, *installed;
+    gchar *package_id, *name, *curr;
+    gboolean inst;
+    int i;
+
+    best = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    installed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; i < packages->len; i++)
+    {
+        item = g_ptr_array_index (packages, i);
+        g_object_get (item, "info", &info, "package-id", &package_id, NULL);
+
+        name = g_strndup (package_id, strcspn (package_id, ";"));
+        curr = g_hash_table_lookup (best, name);
+        inst = (info == PK_INFO_ENUM_INSTALLED);
+        if (!curr || (inst && !g_hash_table_contains (installed, name))
+            || (inst == g_hash_table_contains (installed, name) && strstr (package_id, "arm64") && !strstr (curr, "arm64")))
+        {
+            if (inst) g_hash_table_add (installed, g_strdup (name));
+            g_hash_table_replace (best, name, package_id);
+        }
+        else
+        {
+            g_free (name);
+            g_free (package_id);
+        }
+    }
+    g_hash_table_destroy (installed);
+    return best;
+}
+
+gboolean prefapps_selection_add (GPtrArray *inst, GPtrArray *uninst, gboolean init, gboolean state, const gchar *id, const gchar *rid, const gchar *addids)
+{
+    GPtrArray *set;
+    gchar **adds;
+    int i;
+
+    if (init == state) return FALSE;
+
+    // installing uses the main package; removing uses the rpackage if the entry has one
+    if (state)
+    {
+        set = inst;
+        g_ptr_array_add (set, g_strdup (id));
+    }
+    else
+    {
+        set = uninst;
+        g_ptr_array_add (set, g_strdup (rid && g_strcmp0 (rid, "none") ? rid : id));
+    }
+
+    // additional packages go with the main one either way
+    if (addids && g_strcmp0 (addids, "none"))
+    {
+        adds = g_strsplit (addids, ",", -1);
+        for (i = 0; adds[i]; i++)
+            if (*adds[i]) g_ptr_array_add (set, g_strdup (adds[i]));
+        g_strfreev (adds);
+    }
+    return state;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Package details                                                            */
+/*----------------------------------------------------------------------------*/
+
+gchar *prefapps_details_line (PkDetails *item)
+{
+    gchar *sum, *desc, *ret;
+
+    // escaping keeps each description on one line, and frees the tab to separate summary from description
+    sum = g_strescape (pk_details_get_summary (item) ? pk_details_get_summary (item) : "", NULL);
+    desc = g_strescape (pk_details_get_description (item) ? pk_details_get_description (item) : "", NULL);
+    ret = g_strdup_printf ("DETAIL %s %s\t%s\n", pk_details_get_package_id (item), sum, desc);
+    g_free (sum);
+    g_free (desc);
+    return ret;
+}
+
+GHashTable *prefapps_details_parse (GPtrArray *lines)
+{
+    GHashTable *descs;
+    gchar **fields, *sum, *pd, *desc, *tab;
+    int i;
+
+    // each line is DETAIL <id> <summary>\t<description>, with both strings escaped
+    descs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    for (i = 0; i < lines->len; i++)
+    {
+        fields = g_strsplit (g_ptr_array_index (lines, i), " ", 3);
+        if (!g_strcmp0 (fields[0], "DETAIL") && fields[1] && fields[2] && (tab = strchr (fields[2], '\t')))
+        {
+            *tab = 0;
+            sum = g_strcompress (fields[2]);
+            pd = g_strcompress (tab + 1);
+            desc = prefapps_details_text (*sum ? sum : NULL, *pd ? pd : NULL);
+            if (desc) g_hash_table_replace (descs, g_strndup (fields[1], strcspn (fields[1], ";")), desc);
+            g_free (sum);
+            g_free (pd);
+        }
+        g_strfreev (fields);
+    }
+    return descs;
+}
+
+gchar *prefapps_details_text (const gchar *sum, const gchar *pd)
+{
+    gchar *desc, *ret;
+
+    if (sum && pd)
+    {
+        if (strcmp (sum, pd))
+            desc = g_strdup_printf ("%s\n\n%s", sum, pd);
+        else
+            desc = g_strdup_printf ("%s", sum);
+    }
+    else if (sum)
+        desc = g_strdup_printf ("%s", sum);
+    else if (pd)
+        desc = g_strdup_printf ("%s", pd);
+    else return NULL;
+
+    ret = g_markup_escape_text (desc, strlen (desc));
+    g_free (desc);
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Update status cache                                                        */
+/*----------------------------------------------------------------------------*/
+
+gchar **prefapps_updates_load (void)
+{
+    GMappedFile *map;
+    GVariant *cache;
+    gchar *path, **ids = NULL;
+    gint64 lists, status, clists, cstatus;
+
+    if (!updates_stamp (&lists, &status)) return NULL;
+    path = g_build_filename (cache_dir, UPDATES_CACHE, NULL);
+    map = g_mapped_file_new (path, FALSE, NULL);
+    g_free (path);
+    if (!map) return NULL;
+
+    // the cache holds the times of the package lists and the dpkg status file, followed by the IDs
+    cache = g_variant_new_from_data (G_VARIANT_TYPE ("(xxas)"), g_mapped_file_get_contents (map),
+        g_mapped_file_get_length (map), FALSE, (GDestroyNotify) g_mapped_file_unref, map);
+    g_variant_ref_sink (cache);
+    g_variant_get (cache, "(xx^as)", &clists, &cstatus, &ids);
+    g_variant_unref (cache);
+
+    if (clists != lists || cstatus != status)
+    {
+        g_strfreev (ids);
+        return NULL;
+    }
+    return ids;
+}
+
+void prefapps_updates_save (gchar **ids)
+{
+    GVariant *cache;
+    gchar *path;
+    gint64 lists, status;
+
+    if (!updates_stamp (&lists, &status)) return;
+    cache = g_variant_ref_sink (g_variant_new ("(xx^as)", lists, status, ids));
+    path = g_build_filename (cache_dir, UPDATES_CACHE, NULL);
+    g_mkdir_with_parents (cache_dir, 0755);
+    g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), NULL);
+    g_free (path);
+    g_variant_unref (cache);
+}
+
+static gboolean updates_stamp (gint64 *lists, gint64 *status)
+{
+    GStatBuf st;
+
+    // a refresh changes the lists directory, and any install, removal or upgrade changes the status file
+    if (g_stat (APT_LISTS_DIR, &st)) return FALSE;
+    *lists = st.st_mtime;
+    if (g_stat (DPKG_STATUS, &st)) return FALSE;
+    *status = st.st_mtime;
+    return TRUE;
+}
+
+/* End of file                                                                */
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PREFAPPS_H
+#define PREFAPPS_H
+
+#include <glib.h>
+
+#define I_KNOW_THE_PACKAGEKIT_GLIB2_API_IS_SUBJECT_TO_CHANGE
+#include <packagekit-glib2/packagekit.h>
+
+#include "prefapps_catalog.h"
+
+/* librpprefapps
+ *
+ * The parts of rp-prefapps which have nothing to do with the user interface - loading the catalog, expanding
+ * and matching package names, choosing between package IDs and working out what to install and remove. It
+ * uses GLib and PackageKit, but not GTK, so command-line tools, the catalog service and benchmarks can use
+ * the same code as the application without the cost of starting GTK.
+ */
+
+/* Set in the flags of an entry which a local fragment has hidden */
+
+#define ENTRY_HIDDEN        0x100
+
+/* A catalog entry; the strings belong to the catalog it came from */
+
+typedef struct {
+    const gchar *str[CF_NUM_FIELDS];
+    guint32 flags;
+} CatEntry;
+
+/* One generation of catalog data - the entries, plus the interned strings and the mapped compiled catalog
+ * which they point into. Anything holding on to the strings must be done with them before it is freed. */
+
+typedef struct {
+    GPtrArray *entries;
+    GStringChunk *strings;
+    GMappedFile *map;
+} Catalog;
+
+/* Points the library at another data directory (holding the catalog), configuration directory (holding conf.d)
+ * and cache directory, instead of the installed ones - for tests and tools which run from the source tree. The
+ * strings must last as long as the library is used. */
+
+extern void prefapps_set_dirs (const gchar *data, const gchar *sysconf, const gchar *cache);
+
+/* Loads the catalog for the given language - or for the current locale, if NULL - using the compiled catalog
+ * if it is up to date and the text data files if not, then applies any local fragments. Returns NULL if
+ * neither the compiled catalog nor the data files could be read. */
+
+extern Catalog *prefapps_catalog_load (const gchar *loc);
+extern void prefapps_catalog_free (Catalog *cat);
+
+/* Lists the languages which have translations in the compiled catalog or the data directory; free with g_strfreev */
+
+extern gchar **prefapps_catalog_languages (void);
+
+/* Reads a data file or fragment as a list of (group name, dictionary of keys) pairs, holding the keys which are
+ * present; returns NULL, setting the error, if the file could not be read. Boolean values are read with
+ * prefapps_conf_bool, which accepts true or 1. */
+
+extern GVariant *prefapps_parse_conf (const gchar *path, GError **error);
+extern gboolean prefapps_conf_bool (const gchar *val);
+
+/* Adds the names to be resolved for an entry - its package, any rpackage, and its expanded additional
+ * packages - to an array; the names are owned by the catalog */
+
+extern void prefapps_entry_names (Catalog *cat, const CatEntry *e, const gchar *lang, const gchar *lang_loc, GPtrArray *pnames);
+
+/* Splits a comma-separated additional= list, substituting each %s with the language and with the
+ * language-territory code, and leaving out either of those which is empty; free with g_strfreev */
+
+extern gchar **prefapps_expand_additional (const gchar *adds, const gchar *lang, const gchar *lang_loc);
+
+/* Reads the language and language-territory codes (such as "en" and "en-gb") from the current locale */
+
+extern void prefapps_get_locales (gchar **lang, gchar **lang_loc);
+
+/* Tests whether a string is a valid Debian package name, whether a package ID is for the named package, and
+ * whether an arch= expression matches this machine */
+
+extern gboolean prefapps_valid_name (const gchar *name);
+extern gboolean prefapps_match_pid (const char *name, const char *pid);
+extern gboolean prefapps_match_arch (const char *arch);
+
+/* Chooses one package ID for each name in an array of PkPackages - an installed version if there is one,
+ * otherwise arm64 in preference to armhf. Returns a table of name to ID, both owned by the table. */
+
+extern GHashTable *prefapps_best_ids (GPtrArray *packages);
+
+/* Adds the IDs for one entry to the install or remove set, given whether it was installed when the list was
+ * loaded and whether it is selected now; addids is a comma-separated list of the additional package IDs, or
+ * "none". Returns TRUE if the entry is to be installed. */
+
+extern gboolean prefapps_selection_add (GPtrArray *inst, GPtrArray *uninst, gboolean init, gboolean state, const gchar *id, const gchar *rid, const gchar *addids);
+
+/* Formats package details as a DETAIL line of the catalog service, and reads such lines back into a table of
+ * package name to description text. The text, as made by prefapps_details_text from a summary and a description
+ * either of which may be NULL, is escaped as markup for the description column; it is NULL if there is neither. */
+
+extern gchar *prefapps_details_line (PkDetails *item);
+extern GHashTable *prefapps_details_parse (GPtrArray *lines);
+extern gchar *prefapps_details_text (const gchar *sum, const gchar *pd);
+
+/* Reads the IDs of the catalog packages with updates available, as saved by prefapps_updates_save. Returns
+ * NULL if there is no saved list, or if the package lists or the installed packages have changed since. */
+
+extern gchar **prefapps_updates_load (void);
+extern void prefapps_updates_save (gchar **ids);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PREFAPPS_CATALOG_H
+#define PREFAPPS_CATALOG_H
+
+#include <glib.h>
+
+/* Compiled package catalog
+ *
+ * The catalog is produced at build time by rp-prefapps-compile from prefapps.conf and any
+ * prefapps_<lang>.conf files, and is mapped read-only by rp-prefapps at startup. All integers
+ * are little-endian 32-bit values; all references to strings are byte offsets into the string
+ * table, with offset 0 meaning that the key was not present.
+ *
+ * Layout:
+ *   CatalogHeader
+ *   string table - NUL-terminated strings, starting with a single padding byte
+ *   entry table  - n_entries CatalogEntry records, in data file order
+ *   locale table - n_locales CatalogLocale records
+ *   overlays     - n_entries CatalogEntry records for each locale; a zero field inherits the base value,
+ *                  and flags are always taken from the base entry
+ */
+
+#define CATALOG_MAGIC       "RPPCAT02"
+#define CATALOG_FILE        "prefapps.cat"
+
+/* String fields in each entry */
+
+#define CF_GROUP            0
+#define CF_CATEGORY         1
+#define CF_NAME             2
+#define CF_DESCRIPTION      3
+#define CF_ICON             4
+#define CF_PACKAGE          5
+#define CF_RPACKAGE         6
+#define CF_ADDITIONAL       7
+#define CF_ARCH             8
+#define CF_NUM_FIELDS       9
+
+/* Data file keys for each field - the group name has no key */
+
+#define CATALOG_KEYS        { NULL, "category", "name", "description", "icon", "package", "rpackage", "additional", "arch" }
+
+/* Entry flags */
+
+#define CATALOG_REBOOT      0x01
+#define CATALOG_RPDESC      0x02
+
+typedef struct {
+    gchar magic[8];
+    guint32 n_entries;
+    guint32 n_locales;
+    guint32 strings;
+    guint32 strings_len;
+    guint32 entries;
+    guint32 locales;
+} CatalogHeader;
+
+typedef struct {
+    guint32 field[CF_NUM_FIELDS];
+    guint32 flags;
+} CatalogEntry;
+
+typedef struct {
+    guint32 lang;
+    guint32 overlay;
+} CatalogLocale;
+
+#endif
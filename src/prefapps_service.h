@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PREFAPPS_SERVICE_H
+#define PREFAPPS_SERVICE_H
+
+/* Resident catalog service
+ *
+ * rp-prefapps-service keeps the results of resolving catalog package names, and their details, warm, and shares cache
+ * refreshes between clients. It listens on a UNIX stream socket, normally passed in by systemd socket
+ * activation. Requests and replies are lines of UTF-8 text:
+ *
+ *   REFRESH                  refresh the package cache, unless another client did so recently; a refresh
+ *                            already in progress is shared rather than started again
+ *   RESOLVE <name> ...       resolve package names; replies with one line per package found, of the form
+ *                            PACKAGE <PkInfoEnum value> <package ID>
+ *   DETAILS <package ID> ... read package details; replies with one line per package which has them, of the
+ *                            form DETAIL <package ID> <summary>\t<description>, where both strings are
+ *                            escaped as by g_strescape ()
+ *
+ * Every reply ends with a line reading either END, or ERROR followed by a description. The connection
+ * stays open for further requests until the client closes it. Names and IDs must be valid package names and
+ * package IDs, and a request may hold at most 1024 of them in a line of at most 64 KiB; a longer line closes
+ * the connection. The socket is only open to root and the sudo group.
+ */
+
+#define SERVICE_SOCKET      "/run/rp-prefapps/catalog.sock"
+
+#endif
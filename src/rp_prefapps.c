@@ -31,13 +31,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define _GNU_SOURCE
 #include <string.h>
+#include <locale.h>
 #include <math.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 
@@ -48,6 +56,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <libintl.h>
 
+#include "prefapps.h"
+#include "prefapps_service.h"
+
 /* Columns in packages and categories list stores */
 
 #define PACK_ICON           0
@@ -69,6 +80,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define PACK_REBOOT         16
 #define PACK_ARCH           17
 #define PACK_RPDESC         18
+#define PACK_QUEUED         19
+#define PACK_UPDATE_ID      20
 
 #define CAT_ICON            0
 #define CAT_NAME            1
@@ -76,7 +89,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /* Controls */
 
-static GtkWidget *main_dlg, *cat_tv, *pack_tv, *close_btn, *apply_btn, *search_te;
+static GtkWidget *main_dlg, *cat_tv, *pack_tv, *close_btn, *apply_btn, *update_btn, *bg_btn, *search_te, *size_lbl;
 static GtkWidget *msg_dlg, *msg_msg, *msg_pb, *msg_btn, *msg_cancel, *msg_pbv;
 static GtkWidget *err_dlg, *err_msg, *err_btn;
 
@@ -84,13 +97,251 @@ static GtkWidget *err_dlg, *err_msg, *err_btn;
 
 GtkListStore *categories, *packages;
 
-/* Data stores and counters for packages to install and remove */
+/* The one PackageKit client used for every transaction. The daemon is started, and the system bus connected, by a
+ * thread at start, so that both are up by the time the first transaction is sent; the thread holds the bus
+ * connection so that it stays open for the client to share. */
+
+PkTask *session;
+GDBusConnection *system_bus;
+
+/* Batches of packages to install and remove - each press of Apply queues one, and they are run in turn while the
+ * list can still be used */
+
+typedef struct {
+    gchar **inst;               /* package IDs to install */
+    gchar **uninst;             /* package IDs to remove */
+    gchar **update;             /* package IDs to update to */
+    guint n_inst, n_uninst, n_update;
+    gboolean reboot;            /* something being installed needs a reboot */
+    GSList *rows;               /* GtkTreeIter of each entry in the batch */
+    GPtrArray *done;            /* names of packages already finished, for the journal */
+    PkTask *task;
+} Batch;
+
+GQueue *batches;
+Batch *batch;
+
+/* Journal of the running and waiting batches, in the system state directory - rewritten before each batch starts and
+ * as each package finishes, and removed once there is nothing left to do, so it only survives an interruption */
+
+#define JOURNAL_FILE        "journal"
+
+GQueue *resume;
+gboolean journal_checked;
+
+/* Set once the window has been closed with batches still running - the rest are run at background priority, and
+ * the result is reported by a desktop notification before quitting */
+
+gboolean detached;
+
+/* The current generation of catalog data, from the system catalog merged with any local fragments. The category,
+ * package, additional package and arch columns of the packages list store point into its strings rather than
+ * holding copies, and the whole generation is freed at once when the catalog is reloaded. */
+
+Catalog *catalog;
+
+/* Combined install and remove transaction run directly through apt */
+
+#define ASKPASS_HELPER "/usr/lib/rp-prefapps/pwdrpp.sh"
+
+GIOChannel *apt_out;
+guint apt_watch;
+gchar *apt_error;
+GPid apt_pid;
 
-guint n_inst, n_uninst;
-gchar **pinst, **puninst;
+/* Cancellation of the current asynchronous operation */
+
+GCancellable *cancellable;
+gboolean can_cancel = TRUE, quit_on_cancel = FALSE;
+
+/* Stages of asynchronous operations, for deadlines, retries and the watchdog */
+
+#define STAGE_NONE          0
+#define STAGE_REFRESH       1
+#define STAGE_RESOLVE       2
+#define STAGE_INSTALL       3
+#define STAGE_REMOVE        4
+#define STAGE_SELF_UPDATE   5
+#define NUM_STAGES          6
+
+/* Defaults in seconds - can be overridden in the [Timeouts] section of the settings file; 0 means no limit */
+
+int stage_timeout[NUM_STAGES] = { 0, 300, 120, 0, 0, 120 };
+int watchdog_timeout = 180, max_retries = 3;
+
+int stage = STAGE_NONE, retries;
+gboolean stage_active, timed_out;
+gint64 stage_time, progress_time;
+GSourceFunc stage_retry;
+gpointer stage_data;
+guint retry_id;
+
+/* Download and disk space estimate for the current selection */
+
+typedef struct {
+    Batch *sel;             /* the selection being estimated */
+    GPtrArray *inst;        /* apt names of everything the simulated install would add */
+    GPtrArray *uninst;      /* apt names of everything the simulated removal would take away */
+    GPtrArray *upgrade;     /* apt names of the installed packages which the install would replace with another version */
+    GHashTable *sizes;      /* apt name to download size as a guint64, for sizes of individual entries */
+    guint64 download;       /* bytes to be fetched */
+    guint64 installed;      /* bytes added on disk by installed packages */
+    guint64 freed;          /* bytes released by removed packages */
+    guint64 avail;          /* bytes free on the root filesystem */
+    GCancellable *cancel;   /* cancelled when the selection changes again */
+} SizeEstimate;
+
+GCancellable *est_cancel;
+guint est_timer;
+gboolean est_short;
+
+/* Requests to the resident catalog service, if it is running - see prefapps_service.h */
+
+typedef void (*ServiceReply) (PkTask *task, GPtrArray *lines);
+
+typedef struct {
+    PkTask *task;
+    gchar *request;
+    GCancellable *cancel;
+    ServiceReply callback;
+    GSocketConnection *conn;
+    GDataInputStream *in;
+    GPtrArray *lines;
+} ServiceCall;
+
+gboolean use_service = TRUE;
+
+/* Transaction log - one JSON record per PackageKit or apt transaction, appended to a file in the system log
+ * directory, which is rotated once it reaches max_size bytes; set in the [Log] section of the settings file */
+
+#define TXLOG_FILE          "transactions.jsonl"
+
+typedef struct {
+    const char *type;           /* refresh, resolve, details, get-updates, update, install or remove */
+    const char *backend;        /* packagekit or apt */
+    gint64 start;               /* wall clock, in microseconds */
+    gchar **packages;           /* names or IDs the transaction was asked about */
+    GString *timeline;          /* JSON objects for each status change, comma-separated */
+    gint status;
+    gchar *package;
+    guint64 dl_total, dl_left;
+} TxLog;
+
+int txlog_max_size = 512 * 1024;
+int txlog_keep = 3;
+
+/* Offline package bundle - a directory of .deb files with a Packages index, as written by dpkg-scanpackages,
+ * given with --bundle <dir>; catalog entries are resolved against the index, and installed from the files */
+
+#define BUNDLE_INDEX        "Packages"
+#define BUNDLE_DATA         "bundle"
+#define DPKG_STATUS_FILE    "/var/lib/dpkg/status"
+
+typedef struct {
+    gchar *name;
+    gchar *version;
+    gchar *arch;
+    gchar *file;
+    gchar *summary;
+    gchar *description;
+    gchar *depends;
+} BundlePkg;
+
+GHashTable *bundle;         /* package name -> BundlePkg, for the native architecture or all */
+gchar *bundle_dir;
+GHashTable *bundle_installed;   /* package name -> BundlePkg, for installed packages, read from the dpkg status file */
+gint64 bundle_status_time, bundle_status_size;
+
+/* Headless pre-warm run - skipped if the one-minute load average is above this */
+
+#define PREWARM_MAX_LOAD    1.0
+
+GMainLoop *prewarm_loop;
+int prewarm_status;
+
+/* Names to resolve, and then package IDs to fetch details for, which are sent to the service RESOLVE_CHUNK at a time
+ * from prewarm_next on, as it limits the names on one request; packages resolved so far are kept in prewarm_found */
+
+GPtrArray *prewarm_names;
+guint prewarm_next;
+GPtrArray *prewarm_found;
+
+/* Set while the list is shown from the catalog but its packages have not yet been found; progress messages go to
+ * the status label rather than a dialog, so that the list can be browsed in the meantime */
+
+gboolean pending;
+
+/* Locks taken by apt and dpkg - if another program holds one, the transaction waits for it to be released rather
+ * than failing, watching the lock file for the holder closing it */
+
+static const char *lock_files[] = { "/var/lib/dpkg/lock-frontend", "/var/lib/dpkg/lock", "/var/lib/apt/lists/lock",
+    "/var/cache/apt/archives/lock", NULL };
+
+GFileMonitor *lock_mon;
+gchar *lock_path;
+pid_t lock_pid;
+GSourceFunc lock_then;
+gpointer lock_data;
+gint64 lock_start;
+guint lock_timer;
+
+/* The catalog is read on a worker thread, its icons are looked up in the icon theme on the main thread, and the
+ * icon files are then decoded on a worker thread, as only GLib and GdkPixbuf are safe to use away from the main
+ * thread. New list stores are built from the results on the main thread and swapped in whole; a snapshot arriving
+ * at any stage after a newer load was started is thrown away. */
+
+typedef struct {
+    guint gen;                  /* load_gen when the load was started */
+    gboolean add_cats;          /* build a new categories list as well */
+    gchar *loc;                 /* language code of the catalog to read */
+    Catalog *catalog;           /* the catalog read, or NULL if it could not be */
+    gchar **names;              /* package names to resolve, pointing into the catalog */
+    GHashTable *paths;          /* icon name -> file, for each icon used, from the icon theme */
+    GHashTable *icons;          /* icon name -> GdkPixbuf, decoded from paths */
+    GtkListStore *packages;     /* list store for the packages list */
+    GtkListStore *categories;   /* list store for the categories list, if add_cats */
+} CatalogSnapshot;
+
+guint load_gen;
+gboolean loading;
+PkTask *load_waiting;
+
+/* Package names for the current resolve request, which are resolved RESOLVE_CHUNK at a time with up to RESOLVE_PARALLEL
+ * transactions running at once; packages are queued as they arrive, and merged into the list RESOLVE_SLICE at a time
+ * when idle */
+
+#define RESOLVE_CHUNK       200
+#define RESOLVE_PARALLEL    2
+#define RESOLVE_SLICE       50
+
+typedef struct {
+    TxLog *tx;
+    gchar **names;              /* this chunk of resolve_names - only the array is owned */
+    guint gen;                  /* resolve_gen when sent; anything from an abandoned attempt is dropped */
+} ResolveChunk;
+
+gchar **resolve_names;
+guint resolve_count, resolve_next, resolve_gen;
+int resolve_running;
+PkTask *resolve_task;
+GQueue *resolve_queue;          /* packages not yet merged into the list */
+GPtrArray *resolve_found;       /* packages already merged, for choosing additional package IDs at the end */
+GHashTable *resolve_rows;       /* package or rpackage name -> GSList of GtkTreeIter for entries using it */
+guint resolve_idle;
+
+/* Package details, fetched as entries scroll into view */
+
+GCancellable *det_cancel;
+GHashTable *det_requested;
+guint det_idle;
 
 char *lang, *lang_loc;
 gboolean needs_reboot, no_update = FALSE, is_pi = TRUE;
+
+/* Catalogs with at least this many entries are shown with fixed-height rows, so only visible rows are measured;
+ * can be overridden by the fixed_rows key in the [List] section of the settings file; 0 means always */
+
+int fixed_rows_above = 500;
 int calls;
 gchar *sel_cat;
 
@@ -100,21 +351,133 @@ gchar *sel_cat;
 
 static char *name_from_id (const gchar *id);
 static void progress (PkProgress *progress, PkProgressType *type, gpointer data);
-static PkResults *error_handler (PkTask *task, GAsyncResult *res, char *desc, gboolean silent, gboolean terminal);
+static PkResults *error_handler (PkTask *task, GAsyncResult *res, TxLog *tx, char *desc, gboolean silent, gboolean terminal);
+static void cancelled (gboolean terminal);
+static gboolean cancel_skip (void);
+static TxLog *tx_begin (const char *type, const char *backend, gchar **packages);
+static void tx_step (TxLog *tx, gint status, const char *name, const gchar *package);
+static void tx_progress (PkProgress *progress, PkProgressType *type, gpointer data);
+static void tx_finish (TxLog *tx, PkResults *results, GError *error);
+static void tx_write (TxLog *tx, const char *result, const char *code, const char *detail, int exit_status);
+static void tx_append (const gchar *line);
+static void json_str (GString *str, const gchar *val);
+static void json_time (GString *str, gint64 usec);
+static void start_stage (int st, GSourceFunc retry, gpointer data);
+static gboolean is_transient (GError *error, PkError *pkerror);
+static gboolean retry_stage (char *desc);
+static gboolean retry_timeout (gpointer data);
+static gboolean watchdog (gpointer data);
+static pid_t lock_holder (const char *path);
+static gboolean lock_wait (GSourceFunc then, gpointer data);
+static void lock_check (void);
+static void lock_changed (GFileMonitor *mon, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data);
+static void lock_resume (void);
+static gboolean lock_tick (gpointer data);
+static void lock_stop (void);
+static gpointer session_warm (gpointer data);
 static gboolean update_self (gpointer data);
+static void refresh_service_done (PkTask *task, GPtrArray *lines);
 static void refresh_cache_done (PkTask *task, GAsyncResult *res, gpointer data);
+static void check_self_update (PkTask *task);
 static gboolean filter_fn (PkPackage *package, gpointer user_data);
 static void resolve_1_done (PkTask *task, GAsyncResult *res, gpointer data);
 static void update_done (PkTask *task, GAsyncResult *res, gpointer data);
 static void read_data_file (PkTask *task);
 static void reload_data_file (PkTask *task);
-static gboolean match_pid (char *name, const char *pid);
-static gboolean match_arch (char *arch);
+static void free_catalog (void);
+static void load_data_file (gboolean add_cats);
+static gpointer load_thread (gpointer data);
+static gboolean load_parsed (gpointer data);
+static void icon_path (CatalogSnapshot *snap, const gchar *name);
+static gpointer icon_thread (gpointer data);
+static gboolean load_done (gpointer data);
+static void free_snapshot (CatalogSnapshot *snap);
+static GtkListStore *packages_store_new (void);
+static GtkListStore *categories_store_new (void);
+static GdkPixbuf *snapshot_icon (CatalogSnapshot *snap, const gchar *name);
+static void add_entry (CatalogSnapshot *snap, const CatEntry *e);
+static gboolean start_resolve (gpointer data);
+static void resolve_send (void);
+static void resolve_progress (PkProgress *prog, PkProgressType *type, gpointer data);
+static void resolve_service_done (PkTask *task, GPtrArray *lines);
 static void resolve_2_done (PkTask *task, GAsyncResult *res, gpointer data);
-static void details_done (PkTask *task, GAsyncResult *res, gpointer data);
+static void queue_package (PkPackage *item);
+static gboolean merge_resolved (gpointer data);
+static void merge_package (PkPackage *item);
+static void resolve_check (void);
+static void index_rows (void);
+static void free_rows (gpointer data);
+static void resolve_reset (void);
+static void set_fixed_rows (gboolean fixed);
+static void show_packages (void);
+static void packages_resolved (void);
+static gchar *details_name (GtkTreeModel *model, GtkTreeIter *iter);
+static void queue_details (void);
+static gboolean fetch_details (gpointer data);
+static void details_done (PkClient *client, GAsyncResult *res, gpointer data);
+static void details_service_done (PkTask *task, GPtrArray *lines);
+static void apply_details (GHashTable *descs);
+static Batch *get_selection (void);
+static void free_batch (Batch *b);
 static void install_handler (GtkButton* btn, gpointer ptr);
+static void next_batch (void);
+static gboolean start_batch (gpointer data);
+static gboolean start_install (gpointer data);
+static gboolean start_remove (gpointer data);
 static void install_done (PkTask *task, GAsyncResult *res, gpointer data);
 static void remove_done (PkTask *task, GAsyncResult *res, gpointer data);
+static void batch_done (const char *msg);
+static void drop_batches (void);
+static void background_handler (GtkButton* btn, gpointer ptr);
+static void notify (const char *summary, const char *body);
+static void queue_batch (Batch *b);
+static void journal_save (void);
+static void journal_batch (GKeyFile *kf, Batch *b, int n);
+static void journal_done (const gchar *package_id);
+static void journal_resume (void);
+static gchar **journal_remaining (GKeyFile *kf, const gchar *group, const gchar *key, gchar **done, guint *n);
+static gchar *current_id (const gchar *name);
+static gchar *current_update_id (const gchar *name);
+static gboolean resume_response (GtkButton *button, gpointer data);
+static void resume_rows (Batch *b);
+static char *apt_name_from_id (const gchar *id, gboolean remove);
+static gboolean apt_transaction (gpointer data);
+static gboolean apt_status (GIOChannel *source, GIOCondition condition, gpointer data);
+static void apt_done (GPid pid, gint status, gpointer data);
+static void check_updates (void);
+static void updates_done (PkClient *client, GAsyncResult *res, gpointer data);
+static void apply_updates (gchar **ids);
+static void update_button (void);
+static void update_handler (GtkButton* btn, gpointer ptr);
+static gboolean start_update (gpointer data);
+static void update_all_done (PkTask *task, GAsyncResult *res, gpointer data);
+static void schedule_estimate (void);
+static gboolean start_estimate (gpointer data);
+static void est_collect (PkResults *results, SizeEstimate *est);
+static void est_install_done (PkClient *client, GAsyncResult *res, gpointer data);
+static void est_remove_done (PkClient *client, GAsyncResult *res, gpointer data);
+static void est_start_sizes (SizeEstimate *est);
+static void est_read_sizes (GTask *gt, gpointer source, gpointer data, GCancellable *cancel);
+static void est_done (GObject *source, GAsyncResult *res, gpointer data);
+static void est_free (gpointer data);
+static gboolean load_bundle (const gchar *dir);
+static GHashTable *read_index (const gchar *path, const gchar *arch, gboolean installed);
+static void free_bundle_pkg (gpointer data);
+static void bundle_resolve (gchar **names);
+static BundlePkg *bundle_lookup (const gchar *id);
+static GHashTable *installed_index (void);
+static gchar **bundle_files (gchar **ids);
+static void bundle_deps (BundlePkg *pkg, GHashTable *installed, GHashTable *seen, GPtrArray *files);
+static gboolean service_call (const gchar *request, PkTask *task, GCancellable *cancel, ServiceReply callback);
+static void service_connected (GObject *source, GAsyncResult *res, gpointer data);
+static void service_line (GObject *source, GAsyncResult *res, gpointer data);
+static void service_done (ServiceCall *call, gboolean ok);
+static int prewarm (void);
+static void prewarm_refreshed (PkTask *task, GPtrArray *lines);
+static void prewarm_resolved (PkTask *task, GPtrArray *lines);
+static void prewarm_done (PkTask *task, GPtrArray *lines);
+static void prewarm_send (const gchar *command, ServiceReply callback);
+static void prewarm_direct_done (PkClient *client, GAsyncResult *res, gpointer data);
 static gboolean reload (GtkButton *button, gpointer data);
 static gboolean quit (GtkButton *button, gpointer data);
 static void error_box (char *msg, gboolean terminal);
@@ -128,10 +491,14 @@ static const char *cat_icon_name (char *category);
 static gboolean match_category (GtkTreeModel *model, GtkTreeIter *iter, gpointer data);
 static gboolean packs_in_cat (GtkTreeModel *model, GtkTreeIter *iter, gpointer data);
 static void category_selected (GtkTreeView *tv, gpointer ptr);
+static void update_cell_text (GtkTreeIter *iter);
+static void set_cell_text (GtkListStore *store, GtkTreeIter *iter);
 static void install_toggled (GtkCellRendererToggle *cell, gchar *path, gpointer user_data);
-static void close_handler (GtkButton* btn, gpointer ptr);
+static void cancel_handler (GtkButton* btn, gpointer ptr);
+static gboolean close_handler (GtkButton* btn, gpointer ptr);
 static gboolean search_update (GtkEditable *editable, gpointer userdata);
-static void get_locales (void);
+static void packs_scrolled (GtkAdjustment *adj, gpointer userdata);
+static void read_settings (void);
 
 /*----------------------------------------------------------------------------*/
 /* Helper functions for async operations                                      */
@@ -143,11 +510,18 @@ static char *name_from_id (const gchar *id)
     gboolean valid;
     gchar *tid, *name;
 
+    // returns a copy of the display name, which the caller must free
     valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
     while (valid)
     {
-        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_ID, &tid, PACK_CELL_NAME, &name, -1);
-        if (!g_strcmp0 (id, tid)) return name;
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_ID, &tid, -1);
+        if (!g_strcmp0 (id, tid))
+        {
+            g_free (tid);
+            gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_CELL_NAME, &name, -1);
+            return name;
+        }
+        g_free (tid);
         valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
     }
     return NULL;
@@ -155,37 +529,53 @@ static char *name_from_id (const gchar *id)
 
 static void progress (PkProgress *progress, PkProgressType *type, gpointer data)
 {
+    PkPackage *item;
     char *buf, *name;
     int role = pk_progress_get_role (progress);
     int status = pk_progress_get_status (progress);
 
     //printf ("progress %d %d %d %d %s\n", role, type, status, pk_progress_get_percentage (progress), pk_progress_get_package_id (progress));
 
-    if (msg_dlg)
+    progress_time = g_get_monotonic_time () / G_USEC_PER_SEC;
+    if (data) tx_progress (progress, type, data);
+
+    // mark off each package of a running batch in the journal as it finishes
+    if (batch && (PkProgressType) GPOINTER_TO_INT (type) == PK_PROGRESS_TYPE_PACKAGE && (role == PK_ROLE_ENUM_INSTALL_PACKAGES
+        || role == PK_ROLE_ENUM_INSTALL_FILES || role == PK_ROLE_ENUM_REMOVE_PACKAGES || role == PK_ROLE_ENUM_UPDATE_PACKAGES))
+    {
+        g_object_get (progress, "package", &item, NULL);
+        if (item)
+        {
+            if (pk_package_get_info (item) == PK_INFO_ENUM_FINISHED) journal_done (pk_package_get_id (item));
+            g_object_unref (item);
+        }
+    }
+
+    if (msg_dlg || batch)
     {
+        if (can_cancel != pk_progress_get_allow_cancel (progress))
+        {
+            can_cancel = pk_progress_get_allow_cancel (progress);
+            if (msg_dlg) gtk_widget_set_visible (msg_cancel, can_cancel && !g_cancellable_is_cancelled (cancellable));
+        }
+
         switch (role)
         {
             case PK_ROLE_ENUM_REFRESH_CACHE :       if (status == PK_STATUS_ENUM_LOADING_CACHE)
                                                         message (_("Updating package data - please wait..."), 0, pk_progress_get_percentage (progress));
-                                                    else
+                                                    else if (msg_dlg)
                                                         gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
                                                     break;
 
             case PK_ROLE_ENUM_RESOLVE :             if (status == PK_STATUS_ENUM_LOADING_CACHE)
                                                         message (_("Finding packages - please wait..."), 0, pk_progress_get_percentage (progress));
-                                                    else
+                                                    else if (msg_dlg)
                                                         gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
                                                     break;
 
             case PK_ROLE_ENUM_UPDATE_PACKAGES :     if (status == PK_STATUS_ENUM_LOADING_CACHE)
-                                                        message (_("Updating application - please wait..."), 0, pk_progress_get_percentage (progress));
-                                                    else
-                                                        gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
-                                                    break;
-
-            case PK_ROLE_ENUM_GET_DETAILS :         if (status == PK_STATUS_ENUM_LOADING_CACHE)
-                                                        message (_("Reading package details - please wait..."), 0, pk_progress_get_percentage (progress));
-                                                    else
+                                                        message (batch ? _("Updating applications - please wait...") : _("Updating application - please wait..."), 0, pk_progress_get_percentage (progress));
+                                                    else if (msg_dlg)
                                                         gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
                                                     break;
 
@@ -195,8 +585,10 @@ static void progress (PkProgress *progress, PkProgressType *type, gpointer data)
                                                         buf = g_strdup_printf (_("%s %s - please wait..."), status == PK_STATUS_ENUM_INSTALL ? _("Installing") : _("Downloading"),
                                                             name ? name : _("packages"));
                                                         message (buf, 0, pk_progress_get_percentage (progress));
+                                                        g_free (buf);
+                                                        g_free (name);
                                                     }
-                                                    else
+                                                    else if (msg_dlg)
                                                         gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
                                                     break;
 
@@ -207,29 +599,51 @@ static void progress (PkProgress *progress, PkProgressType *type, gpointer data)
                                                         {
                                                             buf = g_strdup_printf (_("Removing %s - please wait..."), name);
                                                             message (buf, 0, pk_progress_get_percentage (progress));
+                                                            g_free (buf);
+                                                            g_free (name);
                                                         }
                                                         else
                                                             message (_("Removing packages - please wait..."), 0, pk_progress_get_percentage (progress));
                                                    }
-                                                    else
+                                                    else if (msg_dlg)
                                                         gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
                                                     break;
         }
     }
 }
 
-static PkResults *error_handler (PkTask *task, GAsyncResult *res, char *desc, gboolean silent, gboolean terminal)
+static PkResults *error_handler (PkTask *task, GAsyncResult *res, TxLog *tx, char *desc, gboolean silent, gboolean terminal)
 {
     PkResults *results;
     PkError *pkerror;
     GError *error = NULL;
     gchar *buf;
 
+    // the caller owns the results if they are returned; on any error they are released here
     results = pk_task_generic_finish (task, res, &error);
+    tx_finish (tx, results, error);
+    if (g_cancellable_is_cancelled (cancellable) && !silent)
+    {
+        if (error) g_error_free (error);
+        if (results) g_object_unref (results);
+        cancelled (terminal);
+        return NULL;
+    }
+
     if (error != NULL)
     {
-        if (silent) return NULL;
+        if (silent)
+        {
+            g_error_free (error);
+            return NULL;
+        }
+        if (is_transient (error, NULL) && retry_stage (desc))
+        {
+            g_error_free (error);
+            return NULL;
+        }
         buf = g_strdup_printf (_("Error %s - %s"), desc, error->message);
+        g_error_free (error);
         error_box (buf, terminal);
         g_free (buf);
         return NULL;
@@ -238,8 +652,14 @@ static PkResults *error_handler (PkTask *task, GAsyncResult *res, char *desc, gb
     pkerror = pk_results_get_error_code (results);
     if (pkerror != NULL)
     {
-        if (silent) return NULL;
+        g_object_unref (results);
+        if (silent || (is_transient (NULL, pkerror) && retry_stage (desc)))
+        {
+            g_object_unref (pkerror);
+            return NULL;
+        }
         buf = g_strdup_printf (_("Error %s - %s"), desc, pk_error_get_details (pkerror));
+        g_object_unref (pkerror);
         error_box (buf, terminal);
         g_free (buf);
         return NULL;
@@ -248,996 +668,3519 @@ static PkResults *error_handler (PkTask *task, GAsyncResult *res, char *desc, gb
     return results;
 }
 
-/*----------------------------------------------------------------------------*/
-/* Handlers for asynchronous initialisation sequence at start                 */
-/*----------------------------------------------------------------------------*/
-
-static gboolean update_self (gpointer data)
+static void cancelled (gboolean terminal)
 {
-    PkTask *task;
+    char *buf;
 
-    message (_("Updating package data - please wait..."), 0 , -1);
+    g_cancellable_reset (cancellable);
+    can_cancel = TRUE;
 
-    task = pk_task_new ();
-    if (no_update)
+    // cancelled by the watchdog rather than the user - try again, or give up
+    if (timed_out && !quit_on_cancel)
     {
-        read_data_file (task);
-        return FALSE;
+        timed_out = FALSE;
+        if (retry_stage (_("waiting for package manager"))) return;
+        buf = g_strdup_printf (_("Error %s - %s"), _("waiting for package manager"), _("no response"));
+        error_box (buf, terminal);
+        g_free (buf);
+        return;
     }
-    pk_client_refresh_cache_async (PK_CLIENT (task), TRUE, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) refresh_cache_done, NULL);
-    return FALSE;
+
+    // unwind to the main window, or out of the application if there is nothing to show yet
+    if (terminal || quit_on_cancel) quit (NULL, (void *) 0);
+    else reload (NULL, NULL);
 }
 
-static void refresh_cache_done (PkTask *task, GAsyncResult *res, gpointer data)
+static gboolean cancel_skip (void)
 {
-    gchar *pkg[2] = { "rp-prefapps", NULL };
+    // cancelling an optional startup stage skips it, unless the window is being closed
+    if (quit_on_cancel)
+    {
+        quit (NULL, (void *) 0);
+        return FALSE;
+    }
+    g_cancellable_reset (cancellable);
+    can_cancel = TRUE;
 
-    if (!error_handler (task, res, _("updating package data"), FALSE, TRUE)) return;
+    // a stalled stage is retried if it can be, and skipped if not
+    if (timed_out)
+    {
+        timed_out = FALSE;
+        if (retry_stage (_("waiting for package manager"))) return FALSE;
+    }
+    return TRUE;
+}
 
-    message (_("Finding packages - please wait..."), 0 , -1);
+/*----------------------------------------------------------------------------*/
+/* Transaction log                                                            */
+/*----------------------------------------------------------------------------*/
 
-    pk_client_resolve_async (PK_CLIENT (task), 0, pkg, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) resolve_1_done, NULL);
+static TxLog *tx_begin (const char *type, const char *backend, gchar **packages)
+{
+    TxLog *tx;
+
+    tx = g_new0 (TxLog, 1);
+    tx->type = type;
+    tx->backend = backend;
+    tx->start = g_get_real_time ();
+    tx->packages = g_strdupv (packages);
+    tx->timeline = g_string_new (NULL);
+    tx->status = -1;
+    return tx;
 }
 
-static gboolean filter_fn (PkPackage *package, gpointer user_data)
+static void tx_step (TxLog *tx, gint status, const char *name, const gchar *package)
 {
-    if (is_pi) return TRUE;
-    if (strstr (pk_package_get_arch (package), "amd64")) return FALSE;
-    return TRUE;
+    // only changes are recorded, so the timeline shows how long each step and each package took
+    if (status == tx->status && !g_strcmp0 (package, tx->package)) return;
+    tx->status = status;
+    g_free (tx->package);
+    tx->package = g_strdup (package);
+
+    if (tx->timeline->len) g_string_append_c (tx->timeline, ',');
+    g_string_append_printf (tx->timeline, "{\"t\":%" G_GINT64_FORMAT ",\"status\":", (g_get_real_time () - tx->start) / 1000);
+    json_str (tx->timeline, name);
+    if (package && *package)
+    {
+        g_string_append (tx->timeline, ",\"package\":");
+        json_str (tx->timeline, package);
+    }
+    g_string_append_c (tx->timeline, '}');
 }
 
-static void resolve_1_done (PkTask *task, GAsyncResult *res, gpointer data)
+static void tx_progress (PkProgress *progress, PkProgressType *type, gpointer data)
 {
-    PkResults *results;
-    PkPackageSack *sack, *fsack;
-    gchar **ids;
-
-    results = error_handler (task, res, _("finding packages"), TRUE, FALSE);
+    TxLog *tx = (TxLog *) data;
+    guint64 left = pk_progress_get_download_size_remaining (progress);
+    int status = pk_progress_get_status (progress);
 
-    // Ignore errors here - if the update failed, carry on with existing data...
-    if (results)
+    // the largest amount left to download is taken as the total, and the latest as what never arrived
+    if (left && left != G_MAXUINT64)
     {
-        sack = pk_results_get_package_sack (results);
-        fsack = pk_package_sack_filter (sack, filter_fn, NULL);
-
-        ids = pk_package_sack_get_ids (fsack);
-        if (*ids)
-        {
-            message (_("Updating application - please wait..."), 0 , -1);
-            pk_task_update_packages_async (task, ids, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) update_done, NULL);
-            g_strfreev (ids);
-            g_object_unref (sack);
-            g_object_unref (fsack);
-        }
-        else
-        {
-            g_object_unref (sack);
-            g_object_unref (fsack);
-            read_data_file (task);
-        }
+        if (left > tx->dl_total) tx->dl_total = left;
+        tx->dl_left = left;
     }
-    else read_data_file (task);
+    else if (tx->dl_total && status != PK_STATUS_ENUM_DOWNLOAD) tx->dl_left = 0;
+
+    if (status != PK_STATUS_ENUM_UNKNOWN) tx_step (tx, status, pk_status_enum_to_string (status), pk_progress_get_package_id (progress));
 }
 
-static void update_done (PkTask *task, GAsyncResult *res, gpointer data)
+static void tx_finish (TxLog *tx, PkResults *results, GError *error)
 {
-    // No point handling error here - if the update failed, carry on with existing data...
+    PkError *pkerror = NULL;
 
-    read_data_file (task);
-}
+    // records the outcome of a PackageKit transaction; neither the results nor the error are consumed
+    if (!tx) return;
+    if (results) pkerror = pk_results_get_error_code (results);
 
-static void read_data_file (PkTask *task)
-{
-    GtkTreeIter entry, cat_entry;
-    GdkPixbuf *icon;
-    GKeyFile *kf;
-    gchar **groups, **pnames;
-    gchar *buf, *cat, *name, *desc, *iname, *loc, *pack, *rpack, *adds, *add, *addspl, *arch;
-    gboolean new, reboot, rpdesc;
-    int pcount = 0, gcount = 0;
+    if (error)
+        tx_write (tx, g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) || g_cancellable_is_cancelled (cancellable) ? "cancelled" : "failed",
+            NULL, error->message, -1);
+    else if (pkerror)
+        tx_write (tx, pk_error_get_code (pkerror) == PK_ERROR_ENUM_TRANSACTION_CANCELLED ? "cancelled" : "failed",
+            pk_error_enum_to_string (pk_error_get_code (pkerror)), pk_error_get_details (pkerror), -1);
+    else tx_write (tx, results ? "success" : "failed", NULL, NULL, -1);
 
-    loc = setlocale (0, "");
-    strtok (loc, "_. ");
-    buf = g_strdup_printf ("%s/prefapps_%s.conf", PACKAGE_DATA_DIR, loc);
+    if (pkerror) g_object_unref (pkerror);
+}
 
-    pnames = malloc (sizeof (gchar *));
+static void tx_write (TxLog *tx, const char *result, const char *code, const char *detail, int exit_status)
+{
+    GString *rec;
+    gint64 end = g_get_real_time ();
+    int i;
 
-    kf = g_key_file_new ();
-    if (g_key_file_load_from_file (kf, buf, G_KEY_FILE_NONE, NULL) ||
-        g_key_file_load_from_file (kf, PACKAGE_DATA_DIR "/prefapps.conf", G_KEY_FILE_NONE, NULL))
+    // writes the record and frees the transaction
+    rec = g_string_new ("{\"type\":");
+    json_str (rec, tx->type);
+    g_string_append (rec, ",\"backend\":");
+    json_str (rec, tx->backend);
+    g_string_append (rec, ",\"start\":");
+    json_time (rec, tx->start);
+    g_string_append (rec, ",\"end\":");
+    json_time (rec, end);
+    g_string_append_printf (rec, ",\"duration_ms\":%" G_GINT64_FORMAT ",\"packages\":[", (end - tx->start) / 1000);
+    for (i = 0; tx->packages && tx->packages[i]; i++)
     {
-        g_free (buf);
-        gtk_list_store_append (GTK_LIST_STORE (categories), &cat_entry);
-        icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), "rpi", 32, 0, NULL);
-        gtk_list_store_set (categories, &cat_entry, CAT_ICON, icon, CAT_NAME, "All Programs", CAT_DISP_NAME, _("All Programs"), -1);
-        if (icon) g_object_unref (icon);
-        groups = g_key_file_get_groups (kf, NULL);
+        if (i) g_string_append_c (rec, ',');
+        json_str (rec, tx->packages[i]);
+    }
+    g_string_append_printf (rec, "],\"bytes\":%" G_GUINT64_FORMAT ",\"timeline\":[%s],\"result\":", tx->dl_total - tx->dl_left, tx->timeline->str);
+    json_str (rec, result);
+    if (code)
+    {
+        g_string_append (rec, ",\"error_code\":");
+        json_str (rec, code);
+    }
+    if (detail)
+    {
+        g_string_append (rec, ",\"error\":");
+        json_str (rec, detail);
+    }
+    if (exit_status >= 0) g_string_append_printf (rec, ",\"exit_status\":%d", exit_status);
+    g_string_append (rec, "}\n");
 
-        while (groups[gcount])
-        {
-            cat = g_key_file_get_value (kf, groups[gcount], "category", NULL);
-            name = g_key_file_get_value (kf, groups[gcount], "name", NULL);
-            desc = g_key_file_get_value (kf, groups[gcount], "description", NULL);
-            iname = g_key_file_get_value (kf, groups[gcount], "icon", NULL);
-            pack = g_key_file_get_value (kf, groups[gcount], "package", NULL);
-            rpack = g_key_file_get_value (kf, groups[gcount], "rpackage", NULL);
-            adds = g_key_file_get_value (kf, groups[gcount], "additional", NULL);
-            reboot = g_key_file_get_boolean (kf, groups[gcount], "reboot", NULL);
-            arch = g_key_file_get_value (kf, groups[gcount], "arch", NULL);
-            rpdesc = g_key_file_get_boolean (kf, groups[gcount], "rpdesc", NULL);
-
-            // create array of package names
-            pnames = realloc (pnames, (pcount + 1 + (rpack ? 2 : 1)) * sizeof (gchar *));
-            pnames[pcount++] = g_strdup (pack);
-            if (rpack) pnames[pcount++] = g_strdup (rpack);
-            pnames[pcount] = NULL;
-
-            // add additional packages to array of names
-            if (adds && *adds)
-            {
-                // additional packages separated by commas
-                addspl = g_strdup (adds);
-                add = strtok (addspl, ",");
-                while (add)
-                {
-                    if (strchr (add, '%'))
-                    {
-                        // substitute %s with locale strings
-                        if (*lang)
-                        {
-                            pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                            pnames[pcount++] = g_strdup_printf (add, lang);
-                        }
-                        if (*lang_loc)
-                        {
-                            pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                            pnames[pcount++] = g_strdup_printf (add, lang_loc);
-                        }
-                    }
-                    else
-                    {
-                        pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                        pnames[pcount++] = g_strdup (add);
-                    }
-                    add = strtok (NULL, ",");
-                }
-                g_free (addspl);
-            }
+    tx_append (rec->str);
 
-            // add unique entries to category list
-            new = TRUE;
-            gtk_tree_model_get_iter_first (GTK_TREE_MODEL (categories), &cat_entry);
-            while (gtk_tree_model_iter_next (GTK_TREE_MODEL (categories), &cat_entry))
-            {
-                gtk_tree_model_get (GTK_TREE_MODEL (categories), &cat_entry, CAT_NAME, &buf, -1);
-                if (!g_strcmp0 (cat, buf))
-                {
-                    new = FALSE;
-                    g_free (buf);
-                    break;
-                }
-                g_free (buf);
-            } 
+    g_string_free (rec, TRUE);
+    g_string_free (tx->timeline, TRUE);
+    g_strfreev (tx->packages);
+    g_free (tx->package);
+    g_free (tx);
+}
 
-            if (new)
-            {
-                icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), cat_icon_name (cat), 32, 0, NULL);
-                gtk_list_store_append (categories, &cat_entry);
-                gtk_list_store_set (categories, &cat_entry, CAT_ICON, icon, CAT_NAME, cat, CAT_DISP_NAME, _(cat), -1);
-                if (icon) g_object_unref (icon);
-            }
+static void tx_append (const gchar *line)
+{
+    GStatBuf st;
+    FILE *fp;
+    gchar *path, *from, *to;
+    int i;
 
-            // create the entry for the packages list
-            icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), iname, 32, 0, NULL);
-            if (!icon) icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), "application-x-executable", 32, 0, NULL);
-            gtk_list_store_append (packages, &entry);
-            buf = g_strdup_printf (_("<b>%s</b>\n%s"), name, desc);
-            gtk_list_store_set (packages, &entry,
-                PACK_ICON, icon,
-                PACK_CELL_TEXT, buf,
-                PACK_INSTALLED, FALSE,
-                PACK_INIT_INST, FALSE,
-                PACK_CATEGORY, cat,
-                PACK_PACKAGE_NAME, pack,
-                PACK_PACKAGE_ID, "none",
-                PACK_RPACKAGE_NAME, rpack,
-                PACK_RPACKAGE_ID, "none",
-                PACK_CELL_NAME, name,
-                PACK_CELL_DESC, desc,
-                PACK_ADD_NAMES, adds,
-                PACK_ADD_IDS, "none",
-                PACK_REBOOT, reboot,
-                PACK_ARCH, arch ? arch : "any",
-                PACK_RPDESC, rpdesc,
-                -1);
-            if (icon) g_object_unref (icon);
+    // the log is only a diagnostic aid, so any failure to write it is ignored
+    if (!txlog_max_size) return;
+    g_mkdir_with_parents (PACKAGE_LOG_DIR, 0755);
+    path = g_build_filename (PACKAGE_LOG_DIR, TXLOG_FILE, NULL);
 
-            g_free (buf);
-            g_free (cat);
-            g_free (name);
-            g_free (desc);
-            g_free (iname);
-            g_free (pack);
-            g_free (rpack);
-            g_free (adds);
-            g_free (arch);
-
-            gcount++;
+    // shuffle full logs along to .1, .2 and so on, dropping the oldest
+    if (!g_stat (path, &st) && st.st_size + strlen (line) > txlog_max_size)
+    {
+        for (i = txlog_keep; i > 0; i--)
+        {
+            from = i > 1 ? g_strdup_printf ("%s.%d", path, i - 1) : g_strdup (path);
+            to = g_strdup_printf ("%s.%d", path, i);
+            g_rename (from, to);
+            g_free (from);
+            g_free (to);
         }
-        g_free (groups);
+        if (!txlog_keep) g_unlink (path);
     }
-    else
+
+    fp = g_fopen (path, "a");
+    if (fp)
     {
-        // handle no data file here...
-        g_free (buf);
-        g_free (pnames);
-        error_box (_("Unable to open package data file"), TRUE);
-        return;
+        fputs (line, fp);
+        fclose (fp);
     }
-
-    message (_("Finding packages - please wait..."), 0 , -1);
-
-    pk_client_resolve_async (PK_CLIENT (task), 0, pnames, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) resolve_2_done, NULL);
-    g_free (pnames);
+    g_free (path);
 }
 
-
-static void reload_data_file (PkTask *task)
+static void json_str (GString *str, const gchar *val)
 {
-    GtkTreeIter entry, cat_entry;
-    GdkPixbuf *icon;
-    GKeyFile *kf;
-    gchar **groups, **pnames;
-    gchar *buf, *cat, *name, *desc, *iname, *loc, *pack, *rpack, *adds, *add, *addspl, *arch;
-    gboolean new, reboot, rpdesc;
-    int pcount = 0, gcount = 0;
+    const gchar *c;
 
-    loc = setlocale (0, "");
-    strtok (loc, "_. ");
-    buf = g_strdup_printf ("%s/prefapps_%s.conf", PACKAGE_DATA_DIR, loc);
-
-    pnames = malloc (sizeof (gchar *));
-
-    kf = g_key_file_new ();
-    if (g_key_file_load_from_file (kf, buf, G_KEY_FILE_NONE, NULL) ||
-        g_key_file_load_from_file (kf, PACKAGE_DATA_DIR "/prefapps.conf", G_KEY_FILE_NONE, NULL))
+    if (!val)
     {
-        g_free (buf);
-        groups = g_key_file_get_groups (kf, NULL);
+        g_string_append (str, "null");
+        return;
+    }
 
-        while (groups[gcount])
+    g_string_append_c (str, '"');
+    for (c = val; *c; c++)
+    {
+        switch (*c)
         {
-            cat = g_key_file_get_value (kf, groups[gcount], "category", NULL);
-            name = g_key_file_get_value (kf, groups[gcount], "name", NULL);
-            desc = g_key_file_get_value (kf, groups[gcount], "description", NULL);
-            iname = g_key_file_get_value (kf, groups[gcount], "icon", NULL);
-            pack = g_key_file_get_value (kf, groups[gcount], "package", NULL);
-            rpack = g_key_file_get_value (kf, groups[gcount], "rpackage", NULL);
-            adds = g_key_file_get_value (kf, groups[gcount], "additional", NULL);
-            reboot = g_key_file_get_boolean (kf, groups[gcount], "reboot", NULL);
-            arch = g_key_file_get_value (kf, groups[gcount], "arch", NULL);
-            rpdesc = g_key_file_get_boolean (kf, groups[gcount], "rpdesc", NULL);
-
-            // create array of package names
-            pnames = realloc (pnames, (pcount + 1 + (rpack ? 2 : 1)) * sizeof (gchar *));
-            pnames[pcount++] = g_strdup (pack);
-            if (rpack) pnames[pcount++] = g_strdup (rpack);
-            pnames[pcount] = NULL;
-
-            // add additional packages to array of names
-            if (adds && *adds)
-            {
-                // additional packages separated by commas
-                addspl = g_strdup (adds);
-                add = strtok (addspl, ",");
-                while (add)
-                {
-                    if (strchr (add, '%'))
-                    {
-                        // substitute %s with locale strings
-                        if (*lang)
-                        {
-                            pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                            pnames[pcount++] = g_strdup_printf (add, lang);
-                        }
-                        if (*lang_loc)
-                        {
-                            pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                            pnames[pcount++] = g_strdup_printf (add, lang_loc);
-                        }
-                    }
-                    else
-                    {
-                        pnames = realloc (pnames, (pcount + 2) * sizeof (gchar *));
-                        pnames[pcount++] = g_strdup (add);
-                    }
-                    add = strtok (NULL, ",");
-                }
-                g_free (addspl);
-            }
-
-            // create the entry for the packages list
-            icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), iname, 32, 0, NULL);
-            if (!icon) icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), "application-x-executable", 32, 0, NULL);
-            gtk_list_store_append (packages, &entry);
-            buf = g_strdup_printf (_("<b>%s</b>\n%s"), name, desc);
-            gtk_list_store_set (packages, &entry,
-                PACK_ICON, icon,
-                PACK_CELL_TEXT, buf,
-                PACK_INSTALLED, FALSE,
-                PACK_INIT_INST, FALSE,
-                PACK_CATEGORY, cat,
-                PACK_PACKAGE_NAME, pack,
-                PACK_PACKAGE_ID, "none",
-                PACK_RPACKAGE_NAME, rpack,
-                PACK_RPACKAGE_ID, "none",
-                PACK_CELL_NAME, name,
-                PACK_CELL_DESC, desc,
-                PACK_ADD_NAMES, adds,
-                PACK_ADD_IDS, "none",
-                PACK_REBOOT, reboot,
-                PACK_ARCH, arch ? arch : "any",
-                PACK_RPDESC, rpdesc,
-                -1);
-            if (icon) g_object_unref (icon);
-
-            g_free (buf);
-            g_free (cat);
-            g_free (name);
-            g_free (desc);
-            g_free (iname);
-            g_free (pack);
-            g_free (rpack);
-            g_free (adds);
-            g_free (arch);
-
-            gcount++;
+            case '"' :  g_string_append (str, "\\\"");
+                        break;
+            case '\\' : g_string_append (str, "\\\\");
+                        break;
+            case '\n' : g_string_append (str, "\\n");
+                        break;
+            case '\t' : g_string_append (str, "\\t");
+                        break;
+            default :   if ((guchar) *c < 0x20) g_string_append_printf (str, "\\u%04x", *c);
+                        else g_string_append_c (str, *c);
+                        break;
         }
-        g_free (groups);
-    }
-    else
-    {
-        // handle no data file here...
-        g_free (buf);
-        g_free (pnames);
-        error_box (_("Unable to open package data file"), TRUE);
-        return;
     }
+    g_string_append_c (str, '"');
+}
 
-    message (_("Finding packages - please wait..."), 0 , -1);
+static void json_time (GString *str, gint64 usec)
+{
+    GDateTime *dt;
+    gchar *buf;
 
-    pk_client_resolve_async (PK_CLIENT (task), 0, pnames, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) resolve_2_done, NULL);
-    g_free (pnames);
+    // ISO 8601 in UTC, to the millisecond
+    dt = g_date_time_new_from_unix_utc (usec / G_USEC_PER_SEC);
+    buf = g_date_time_format (dt, "%Y-%m-%dT%H:%M:%S");
+    g_string_append_printf (str, "\"%s.%03dZ\"", buf, (int) (usec % G_USEC_PER_SEC / 1000));
+    g_free (buf);
+    g_date_time_unref (dt);
 }
 
+/*----------------------------------------------------------------------------*/
+/* Stage deadlines, retries and watchdog                                      */
+/*----------------------------------------------------------------------------*/
 
-static gboolean match_pid (char *name, const char *pid)
+static void start_stage (int st, GSourceFunc retry, gpointer data)
 {
-    char *buf;
-    gboolean ret = FALSE;
-
-    if (name == NULL) return FALSE;
-    buf = g_strdup (pid);
-    g_strdelimit (buf, ";", 0);
-    if (!g_strcmp0 (buf, name)) ret = TRUE;
-    g_free (buf);
-    return ret;
+    // a new stage gets a fresh set of retries; a retried one carries on counting
+    if (st != stage) retries = 0;
+    stage = st;
+    stage_retry = retry;
+    stage_data = data;
+    stage_time = progress_time = g_get_monotonic_time () / G_USEC_PER_SEC;
+    stage_active = TRUE;
 }
 
-static gboolean match_arch (char *arch)
+static gboolean is_transient (GError *error, PkError *pkerror)
 {
-    if (!g_strcmp0 (arch, "any")) return TRUE;
+    // errors which are worth retrying - network, mirror and lock problems, and an unresponsive daemon
+    if (error)
+        return g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) || g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY)
+            || g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT);
 
-    char *cmd = g_strdup_printf ("arch | grep -q %s", arch);
-    FILE *fp = popen (cmd, "r");
-    int res = pclose (fp);
-    g_free (cmd);
-    if (!res) return TRUE;
-    return FALSE;
+    switch (pk_error_get_code (pkerror))
+    {
+        case PK_ERROR_ENUM_NO_NETWORK :
+        case PK_ERROR_ENUM_CANNOT_GET_LOCK :
+        case PK_ERROR_ENUM_REPO_NOT_AVAILABLE :
+        case PK_ERROR_ENUM_CANNOT_FETCH_SOURCES :
+        case PK_ERROR_ENUM_PACKAGE_DOWNLOAD_FAILED :    return TRUE;
+
+        default :                                       return FALSE;
+    }
 }
 
-static void resolve_2_done (PkTask *task, GAsyncResult *res, gpointer data)
+static gboolean retry_stage (char *desc)
 {
-    PkResults *results;
-    PkPackage *item;
-    PkPackageSack *sack, *fsack;
-    PkInfoEnum info;
-    GPtrArray *array;
-    GtkTreeIter iter;
-    gchar **ids;
-    gboolean valid, inst;
-    gchar *pack, *rpack, *package_id, *arch;
-    gchar *addpks, *addpk, *addids, *addlist;
-    gchar *curr_id;
-    int i;
+    char *buf;
+    int delay;
 
-    results = error_handler (task, res, _("finding packages"), FALSE, TRUE);
-    if (!results) return;
+    if (!stage_retry || retries >= max_retries || quit_on_cancel) return FALSE;
 
-    sack = pk_results_get_package_sack (results);
-    fsack = pk_package_sack_filter (sack, filter_fn, NULL);
-    array = pk_package_sack_get_array (fsack);
+    // back off for 2, 4, 8... seconds between attempts
+    delay = 2 << retries++;
+    stage_active = FALSE;
+    can_cancel = TRUE;
 
-    // Need to loop through the array of returned IDs twice. On the first pass, only look at
-    // IDs of packages which are installed; for each of those, store the ID. Need to store both
-    // ID and rID (if there is one)
+    buf = g_strdup_printf (_("Error %s - retrying in %d seconds..."), desc, delay);
+    message (buf, 0, -1);
+    g_free (buf);
 
-    for (i = 0; i < array->len; i++)
-    {
-        item = g_ptr_array_index (array, i);
-        g_object_get (item, "info", &info, "package-id", &package_id, NULL);
+    retry_id = g_timeout_add_seconds (delay, retry_timeout, NULL);
+    return TRUE;
+}
 
-        if (info == PK_INFO_ENUM_INSTALLED)
-        {
-            valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
-            while (valid)
-            {
-                gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_NAME, &pack, PACK_RPACKAGE_NAME, &rpack, -1);
-                if (match_pid (pack, package_id))
-                {
-                    gtk_list_store_set (packages, &iter, PACK_PACKAGE_ID, package_id, PACK_INSTALLED, TRUE, PACK_INIT_INST, TRUE, -1);
-                    break;
-                }
-                if (match_pid (rpack, package_id))
-                {
-                    gtk_list_store_set (packages, &iter, PACK_RPACKAGE_ID, package_id, PACK_INSTALLED, TRUE, PACK_INIT_INST, TRUE, -1);
-                    break;
-                }
-                valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
-                g_free (pack);
-                g_free (rpack);
-            }
-        }
+static gboolean retry_timeout (gpointer data)
+{
+    retry_id = 0;
+    stage_retry (stage_data);
+    return FALSE;
+}
 
-        // fill in this id for any additional packages which match it
-        valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
-        while (valid)
+static gboolean watchdog (gpointer data)
+{
+    gint64 now = g_get_monotonic_time () / G_USEC_PER_SEC;
+
+    if (!stage_active || g_cancellable_is_cancelled (cancellable)) return TRUE;
+
+    if ((stage_timeout[stage] && now - stage_time > stage_timeout[stage])
+        || (watchdog_timeout && now - progress_time > watchdog_timeout))
+    {
+        if (can_cancel)
         {
-            gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_ADD_NAMES, &addpks, PACK_ADD_IDS, &addids, -1);
-            if (addpks && *addpks)
-            {
-                addpk = strtok (addpks, ",");
-                while (addpk)
-                {
-                    gboolean matched = FALSE;
-                    char *str;
-                    if (strchr (addpk, '%'))
-                    {
-                        // substitute %s with locale strings
-                        if (*lang)
-                        {
-                            str = g_strdup_printf (addpk, lang);
-                            if (match_pid (str, package_id)) matched = TRUE;
-                            g_free (str);
-                        }
-                        if (*lang_loc)
-                        {
-                            str = g_strdup_printf (addpk, lang_loc);
-                            if (match_pid (str, package_id)) matched = TRUE;
-                            g_free (str);
-                        }
-                    }
-                    else if (match_pid (addpk, package_id)) matched = TRUE;
-
-                    if (matched)
-                    {
-                        if (!g_strcmp0 (addids, "none"))
-                            gtk_list_store_set (packages, &iter, PACK_ADD_IDS, package_id, -1);
-                        else
-                        {
-                            // DANGER, WILL ROBINSON - if additional packages ever come in multiple architectures, this will need to be fixed,
-                            // by going through each string in the existing addids array and seeing if it matches the new string except for
-                            // the archicture, and replacing it with the new string if so; just appending it as now otherwise.
-                            // This will be incredibly tedious, so I'm not doing it until I need to...
-                            addlist = g_strdup_printf ("%s,%s", addids, package_id);
-                            gtk_list_store_set (packages, &iter, PACK_ADD_IDS, addlist, -1);
-                            g_free (addlist);
-                        }
-                        break;
-                    }
-                    addpk = strtok (NULL, ",");
-                }
-            }
-            valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
-            g_free (addpks);
-            g_free (addids);
+            // stalled or overdue - cancel it, and let the cancellation handlers retry
+            timed_out = TRUE;
+            stage_active = FALSE;
+            g_cancellable_cancel (cancellable);
+            if (apt_pid) kill (apt_pid, SIGTERM);
         }
-
-        g_free (package_id);
+        else if (msg_dlg) message (_("Waiting for package manager to respond..."), 0, -1);
     }
+    return TRUE;
+}
 
-    // At this point, the database contains a valid package ID (and possibly an rID) for each installed package. It
-    // has no IDs for uninstalled packages - so fill in the rest; only update data for an entry which does not already
-    // have the installed flag set
+/*----------------------------------------------------------------------------*/
+/* Waiting for the package manager lock                                       */
+/*----------------------------------------------------------------------------*/
 
-    for (i = 0; i < array->len; i++)
+static pid_t lock_holder (const char *path)
+{
+    struct flock fl;
+    int fd;
+
+    // opened read-only, so that closing it again does not look like the holder letting go
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+
+    memset (&fl, 0, sizeof (fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    if (fcntl (fd, F_GETLK, &fl) == -1) fl.l_type = F_UNLCK;
+    close (fd);
+
+    // a lock held through an open file description has no owner to report, so use -1 for "unknown"
+    if (fl.l_type == F_UNLCK) return 0;
+    return fl.l_pid > 0 ? fl.l_pid : -1;
+}
+
+static gboolean lock_wait (GSourceFunc then, gpointer data)
+{
+    // once cancelled, let the transaction start so that it fails as cancelled in the usual way
+    if (g_cancellable_is_cancelled (cancellable))
     {
-        item = g_ptr_array_index (array, i);
-        g_object_get (item, "info", &info, "package-id", &package_id, NULL);
+        lock_stop ();
+        return FALSE;
+    }
 
-        if (info != PK_INFO_ENUM_INSTALLED)
-        {
-            valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
-            while (valid)
-            {
-                gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INSTALLED, &inst, PACK_PACKAGE_NAME, &pack, PACK_ARCH, &arch, PACK_PACKAGE_ID, &curr_id, -1);
+    if (!lock_then) lock_start = g_get_monotonic_time () / G_USEC_PER_SEC;
+    lock_then = then;
+    lock_data = data;
+    lock_check ();
+    return lock_then != NULL;
+}
 
-                if (!inst && match_pid (pack, package_id) && match_arch (arch))
-                {
-                    // If this package already has a PID stored, then only overwrite it if the new version is arm64 (because the current one will then be armhf)
-                    if (!g_strcmp0 (curr_id, "none") || strstr (package_id, "arm64"))
-                        gtk_list_store_set (packages, &iter, PACK_PACKAGE_ID, package_id, -1);
-                    break;
-                }
-                valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
-                g_free (pack);
-                g_free (arch);
-            }
+static void lock_check (void)
+{
+    GFile *file;
+    pid_t pid = 0;
+    int i;
+
+    while (TRUE)
+    {
+        for (i = 0; lock_files[i]; i++)
+            if ((pid = lock_holder (lock_files[i]))) break;
+
+        if (!pid)
+        {
+            lock_stop ();
+            return;
         }
-        g_free (package_id);
+        if (!g_strcmp0 (lock_path, lock_files[i])) break;
+
+        // watch the lock which is held - the holder closing it, or exiting, is reported as a change
+        if (lock_mon) g_object_unref (lock_mon);
+        g_free (lock_path);
+        lock_path = g_strdup (lock_files[i]);
+        file = g_file_new_for_path (lock_path);
+        lock_mon = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        if (lock_mon) g_signal_connect (lock_mon, "changed", G_CALLBACK (lock_changed), NULL);
+        g_object_unref (file);
+
+        // it may have been released before the monitor was in place, which no change would report, so look again
+        if ((pid = lock_holder (lock_path))) break;
     }
-    g_ptr_array_unref (array);
+    lock_pid = pid;
 
-    message (_("Reading package details - please wait..."), 0 , -1);
+    // the timer only counts the time shown; the lock itself is only checked again when the file changes
+    if (!lock_timer) lock_timer = g_timeout_add_seconds (1, lock_tick, NULL);
+    lock_tick (NULL);
+}
 
-    ids = pk_package_sack_get_ids (fsack);
-    pk_client_get_details_async (PK_CLIENT (task), ids, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) details_done, NULL);
-    g_strfreev (ids);
-    g_object_unref (sack);
-    g_object_unref (fsack);
+static void lock_changed (GFileMonitor *mon, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data)
+{
+    if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT || event == G_FILE_MONITOR_EVENT_DELETED) lock_resume ();
 }
 
-static int category_sort (GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer userdata)
+static void lock_resume (void)
 {
-    gchar *name1, *name2;
-    int ret;
+    GSourceFunc then = lock_then;
+    gpointer arg = lock_data;
 
-    gtk_tree_model_get (model, a, CAT_DISP_NAME, &name1, -1);
-    gtk_tree_model_get (model, b, CAT_DISP_NAME, &name2, -1);
+    if (!then) return;
 
-    if (!g_strcmp0 (name1, _("All Programs"))) ret = -1;
-    else if (!g_strcmp0 (name2, _("All Programs"))) ret = 1;
-    else ret = g_strcmp0 (name1, name2);
+    // start whatever was waiting if the locks are all free - or straight away once cancelled, so that it fails as
+    // cancelled; it checks the locks again itself, in case another program has taken one meanwhile
+    if (!g_cancellable_is_cancelled (cancellable))
+    {
+        lock_check ();
+        if (lock_then) return;
+    }
+    lock_stop ();
+    then (arg);
+}
 
-    g_free (name1);
-    g_free (name2);
+static gboolean lock_tick (gpointer data)
+{
+    gint64 now = g_get_monotonic_time () / G_USEC_PER_SEC;
+    gchar *path, *comm = NULL, *buf;
 
-    return ret;
+    if (lock_pid > 0)
+    {
+        path = g_strdup_printf ("/proc/%d/comm", lock_pid);
+        if (g_file_get_contents (path, &comm, NULL, NULL)) g_strstrip (comm);
+        g_free (path);
+    }
+
+    if (comm && *comm)
+        buf = g_strdup_printf (_("Waiting for %s (process %d) to finish using the package manager - %d:%02d"), comm, lock_pid,
+            (int) (now - lock_start) / 60, (int) (now - lock_start) % 60);
+    else
+        buf = g_strdup_printf (_("Waiting for another program to finish using the package manager - %d:%02d"),
+            (int) (now - lock_start) / 60, (int) (now - lock_start) % 60);
+    message (buf, 0, -1);
+    g_free (buf);
+    g_free (comm);
+    return TRUE;
 }
 
-static void details_done (PkTask *task, GAsyncResult *res, gpointer data)
+static void lock_stop (void)
 {
-    PkResults *results;
-    PkDetails *item;
-    GPtrArray *array;
-    GtkTreeIter iter;
-    GtkTreeModel *scateg, *fcateg, *spackages, *fpackages;
-    gboolean valid, rpdesc;
-    gchar *pid, *rid, *desc, *esc;
-    const gchar *package_id, *sum, *pd;
-    int i;
+    if (lock_timer) g_source_remove (lock_timer);
+    lock_timer = 0;
+    if (lock_mon) g_object_unref (lock_mon);
+    lock_mon = NULL;
+    g_free (lock_path);
+    lock_path = NULL;
+    lock_pid = 0;
+    lock_then = NULL;
+}
 
-    results = error_handler (task, res, _("reading package details"), FALSE, TRUE);
-    if (!results) return;
+/*----------------------------------------------------------------------------*/
+/* Handlers for asynchronous initialisation sequence at start                 */
+/*----------------------------------------------------------------------------*/
 
-    array = pk_results_get_details_array (results);
+static gpointer session_warm (gpointer data)
+{
+    PkControl *control;
+
+    // blocking calls, so the daemon starts while the main thread carries on - asynchronous ones would need the main
+    // loop, which isn't run until the window is up; nothing is done with the answer, as any problem with the
+    // daemon is reported by the first transaction
+    system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+    control = pk_control_new ();
+    pk_control_get_properties (control, NULL, NULL);
+    g_object_unref (control);
+    return NULL;
+}
 
-    for (i = 0; i < array->len; i++)
-    {
-        item = g_ptr_array_index (array, i);
-        package_id = pk_details_get_package_id (item);
+static gboolean update_self (gpointer data)
+{
+    TxLog *tx;
 
-        valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
-        while (valid)
-        {
-            sum = pk_details_get_summary (item);
-            pd = pk_details_get_description (item);
-            if (sum && pd)
-            {
-                if (strcmp (sum, pd))
-                    desc = g_strdup_printf ("%s\n\n%s", sum, pd);
-                else
-                    desc = g_strdup_printf ("%s", sum);
-            }
-            else if (sum)
-                desc = g_strdup_printf ("%s", sum);
-            else if (pd)
-                desc = g_strdup_printf ("%s", pd);
-            else desc = NULL;
+    message (_("Updating package data - please wait..."), 0 , -1);
 
-            if (desc)
-            {
-                esc = g_markup_escape_text (desc, strlen (desc));
-                g_free (desc);
-            }
-            else esc = NULL;
+    if (no_update)
+    {
+        read_data_file (session);
+        return FALSE;
+    }
+    if (lock_wait (update_self, NULL)) return FALSE;
+    start_stage (STAGE_REFRESH, update_self, NULL);
 
-            gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_NAME, &pid, PACK_RPACKAGE_NAME, &rid, PACK_RPDESC, &rpdesc, -1);
+    // if the service is running, share its refresh with any other clients
+    if (service_call ("REFRESH\n", session, cancellable, refresh_service_done)) return FALSE;
+    tx = tx_begin ("refresh", "packagekit", NULL);
+    pk_client_refresh_cache_async (PK_CLIENT (session), TRUE, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) refresh_cache_done, tx);
+    return FALSE;
+}
 
-            if (match_pid (pid, package_id) && !rpdesc)
-            {
-                gtk_list_store_set (packages, &iter, PACK_DESCRIPTION, esc, -1);
-                g_free (esc);
-                g_free (pid);
-                g_free (rid);
-                break;
-            }
+static void refresh_service_done (PkTask *task, GPtrArray *lines)
+{
+    TxLog *tx;
 
-            if (match_pid (rid, package_id) && rpdesc)
-            {
-                gtk_list_store_set (packages, &iter, PACK_DESCRIPTION, esc, -1);
-                g_free (esc);
-                g_free (pid);
-                g_free (rid);
-                break;
-            }
+    if (!lines)
+    {
+        tx = tx_begin ("refresh", "packagekit", NULL);
+        pk_client_refresh_cache_async (PK_CLIENT (task), TRUE, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) refresh_cache_done, tx);
+        return;
+    }
+    check_self_update (task);
+}
 
-            g_free (esc);
-            g_free (pid);
-            g_free (rid);
-            valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
-        }
+static void refresh_cache_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+
+    if (g_cancellable_is_cancelled (cancellable))
+    {
+        // refresh abandoned - carry on with the existing package data
+        results = error_handler (task, res, (TxLog *) data, NULL, TRUE, FALSE);
+        if (results) g_object_unref (results);
+        if (cancel_skip ()) read_data_file (task);
+        return;
     }
 
-    // data now all loaded - set up filtered and sorted package list
-    spackages = gtk_tree_model_sort_new_with_model (GTK_TREE_MODEL (packages));
-    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (spackages), PACK_CELL_NAME, GTK_SORT_ASCENDING);
-    fpackages = gtk_tree_model_filter_new (GTK_TREE_MODEL (spackages), NULL);
-    gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (fpackages), (GtkTreeModelFilterVisibleFunc) match_category, NULL, NULL);
-    gtk_tree_view_set_model (GTK_TREE_VIEW (pack_tv), GTK_TREE_MODEL (fpackages));
+    results = error_handler (task, res, (TxLog *) data, _("updating package data"), FALSE, TRUE);
+    if (!results) return;
+    g_object_unref (results);
 
-    // set up filtered and sorted category list
-    scateg = gtk_tree_model_sort_new_with_model (GTK_TREE_MODEL (categories));
-    gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (scateg), CAT_NAME, category_sort, NULL, NULL);
-    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (scateg), CAT_NAME, GTK_SORT_ASCENDING);
-    fcateg = gtk_tree_model_filter_new (GTK_TREE_MODEL (scateg), NULL);
-    gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (fcateg), (GtkTreeModelFilterVisibleFunc) packs_in_cat, NULL, NULL);
-    gtk_tree_view_set_model (GTK_TREE_VIEW (cat_tv), GTK_TREE_MODEL (fcateg));
+    check_self_update (task);
+}
 
-    // select category
-    gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL (fcateg), &iter, sel_cat);
-    gtk_tree_selection_select_iter (gtk_tree_view_get_selection (GTK_TREE_VIEW (cat_tv)), &iter);
+static void check_self_update (PkTask *task)
+{
+    gchar *pkg[2] = { "rp-prefapps", NULL };
+    TxLog *tx;
 
-    gtk_widget_set_sensitive (close_btn, TRUE);
-    gtk_widget_set_sensitive (apply_btn, TRUE);
+    message (_("Finding packages - please wait..."), 0 , -1);
 
-    gtk_widget_destroy (GTK_WIDGET (msg_dlg));
-    msg_dlg = NULL;
+    start_stage (STAGE_SELF_UPDATE, NULL, task);
+    tx = tx_begin ("resolve", "packagekit", pkg);
+    pk_client_resolve_async (PK_CLIENT (task), 0, pkg, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) resolve_1_done, tx);
 }
 
-/*----------------------------------------------------------------------------*/
-/* Handlers for asynchronous install and remove sequence                      */
-/*----------------------------------------------------------------------------*/
+static gboolean filter_fn (PkPackage *package, gpointer user_data)
+{
+    if (is_pi) return TRUE;
+    if (strstr (pk_package_get_arch (package), "amd64")) return FALSE;
+    return TRUE;
+}
 
-static void install_handler (GtkButton* btn, gpointer ptr)
+static void resolve_1_done (PkTask *task, GAsyncResult *res, gpointer data)
 {
-    PkTask *task;
-    GtkTreeIter iter;
-    gboolean valid, state, init, reboot;
-    gchar *id, *rid, *addid, *addids;
+    PkResults *results;
+    PkPackageSack *sack, *fsack;
+    gchar **ids;
+    TxLog *tx;
 
-    gtk_widget_set_sensitive (close_btn, FALSE);
-    gtk_widget_set_sensitive (apply_btn, FALSE);
+    results = error_handler (task, res, (TxLog *) data, _("finding packages"), TRUE, FALSE);
 
-    n_inst = 0;
-    n_uninst = 0;
-    pinst = malloc (sizeof (gchar *));
-    pinst[n_inst] = NULL;
-    pinst = malloc (sizeof (gchar *));
-    pinst[n_uninst] = NULL;
+    if (g_cancellable_is_cancelled (cancellable))
+    {
+        if (results) g_object_unref (results);
+        if (cancel_skip ()) read_data_file (task);
+        return;
+    }
 
-    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
-    while (valid)
+    // Ignore errors here - if the update failed, carry on with existing data...
+    if (results)
     {
-        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INSTALLED, &state, PACK_INIT_INST, &init, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_ADD_IDS, &addid, PACK_REBOOT, &reboot, -1);
-        if (!init)
-        {
-            if (state)
-            {
-                // needs install
-                pinst = realloc (pinst, (n_inst + 2) * sizeof (gchar *));
-                pinst[n_inst++] = g_strdup (id);
-                pinst[n_inst] = NULL;
-                if (reboot) needs_reboot = TRUE;
+        sack = pk_results_get_package_sack (results);
+        fsack = pk_package_sack_filter (sack, filter_fn, NULL);
+        g_object_unref (results);
 
-                if (g_strcmp0 (addid, "none"))
-                {
-                    addids = strtok (addid, ",");
-                    while (addids)
-                    {
-                        pinst = realloc (pinst, (n_inst + 2) * sizeof (gchar *));
-                        pinst[n_inst++] = g_strdup (addids);
-                        pinst[n_inst] = NULL;
-                        addids = strtok (NULL, ",");
-                    }
-                }
-            }
+        ids = pk_package_sack_get_ids (fsack);
+        if (*ids)
+        {
+            message (_("Updating application - please wait..."), 0 , -1);
+            tx = tx_begin ("update", "packagekit", ids);
+            pk_task_update_packages_async (task, ids, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) update_done, tx);
+            g_strfreev (ids);
+            g_object_unref (sack);
+            g_object_unref (fsack);
         }
         else
         {
-            if (!state)
-            {
-                // needs uninstall
-                puninst = realloc (puninst, (n_uninst + 2) * sizeof (gchar *));
-                if (rid && g_strcmp0 (rid, "none"))
-                    puninst[n_uninst++] = g_strdup (rid);
-                else
-                    puninst[n_uninst++] = g_strdup (id);
-                puninst[n_uninst] = NULL;
-
-                if (g_strcmp0 (addid, "none"))
-                {
-                    addids = strtok (addid, ",");
-                    while (addids)
-                    {
-                        puninst = realloc (puninst, (n_uninst + 2) * sizeof (gchar *));
-                        puninst[n_uninst++] = g_strdup (addids);
-                        puninst[n_uninst] = NULL;
-                        addids = strtok (NULL, ",");
-                    }
-                }
-            }
+            g_object_unref (sack);
+            g_object_unref (fsack);
+            read_data_file (task);
         }
-        g_free (id);
-        g_free (rid);
-        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
     }
+    else read_data_file (task);
+}
 
-    if (n_inst)
-    {
-        message (_("Installing packages - please wait..."), 0 , -1);
+static void update_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+    GError *error = NULL;
 
-        task = pk_task_new ();
-        pk_task_install_packages_async (task, pinst, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) install_done, NULL);
-    }
-    else if (n_uninst)
-    {
-        message (_("Removing packages - please wait..."), 0 , -1);
+    // No point handling error here - if the update failed, carry on with existing data...
+    results = pk_task_generic_finish (task, res, &error);
+    tx_finish ((TxLog *) data, results, error);
+    if (results) g_object_unref (results);
+    if (error) g_error_free (error);
 
-        task = pk_task_new ();
-        pk_task_remove_packages_async (task, puninst, TRUE, TRUE, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) remove_done, NULL);
-    }
-    else
-    {
-        gtk_widget_set_sensitive (close_btn, TRUE);
-        gtk_widget_set_sensitive (apply_btn, TRUE);
-    }
+    if (g_cancellable_is_cancelled (cancellable) && !cancel_skip ()) return;
+
+    // the update may have brought a new catalog, so show that instead of the one read at start
+    load_data_file (TRUE);
+    read_data_file (task);
 }
 
-static void install_done (PkTask *task, GAsyncResult *res, gpointer data)
+static void read_data_file (PkTask *task)
 {
-    if (!error_handler (task, res, _("installing packages"), FALSE, FALSE)) return;
+    // the list is shown from the catalog before the startup checks, so only its packages need finding here - if it
+    // is still being read, they are found as soon as it arrives
+    if (loading) load_waiting = task;
+    else start_resolve (task);
+}
 
-    if (n_uninst)
-    {
-        message (_("Removing packages - please wait..."), 0 , -1);
+static void reload_data_file (PkTask *task)
+{
+    load_data_file (FALSE);
+    read_data_file (task);
+}
 
-        pk_task_remove_packages_async (task, puninst, TRUE, TRUE, NULL, (PkProgressCallback) progress, NULL, (GAsyncReadyCallback) remove_done, NULL);
-    }
-    else
-        message (_("Installation complete"), 1, -1);
+static void free_catalog (void)
+{
+    // only called once the packages list store has been cleared, as it points into this data
+    resolve_reset ();
+    g_free (resolve_names);
+    resolve_names = NULL;
+    prefapps_catalog_free (catalog);
+    catalog = NULL;
 }
 
-static void remove_done (PkTask *task, GAsyncResult *res, gpointer data)
+static void load_data_file (gboolean add_cats)
+{
+    CatalogSnapshot *snap;
+
+    // entries are shown as pending until their packages have been found
+    pending = TRUE;
+    loading = TRUE;
+    gtk_widget_hide (update_btn);
+
+    // the language is read here, as the locale can't safely be looked at from the worker
+    snap = g_new0 (CatalogSnapshot, 1);
+    snap->gen = ++load_gen;
+    snap->add_cats = add_cats;
+    snap->loc = g_strdup (setlocale (LC_CTYPE, NULL));
+    strtok (snap->loc, "_. ");
+    g_thread_unref (g_thread_new ("catalog", load_thread, snap));
+}
+
+static gpointer load_thread (gpointer data)
 {
-    if (!error_handler (task, res, _("removing packages"), FALSE, FALSE)) return;
+    CatalogSnapshot *snap = (CatalogSnapshot *) data;
+    GPtrArray *pnames;
+    CatEntry *e;
+    int i;
 
-    if (n_inst)
-        message (_("Installation and removal complete"), 1, -1);
-    else
-        message (_("Removal complete"), 1, -1);
+    snap->catalog = prefapps_catalog_load (snap->loc);
+    if (snap->catalog)
+    {
+        pnames = g_ptr_array_new ();
+        for (i = 0; i < snap->catalog->entries->len; i++)
+        {
+            e = g_ptr_array_index (snap->catalog->entries, i);
+            if (!(e->flags & ENTRY_HIDDEN)) prefapps_entry_names (snap->catalog, e, lang, lang_loc, pnames);
+        }
+        g_ptr_array_add (pnames, NULL);
+
+        // the names themselves belong to the catalog generation; only the array is owned here
+        snap->names = (gchar **) g_ptr_array_free (pnames, FALSE);
+    }
+
+    gdk_threads_add_idle (load_parsed, snap);
+    return NULL;
 }
 
-static gboolean clock_synced (void)
+static gboolean load_parsed (gpointer data)
 {
-    if (system ("test -e /usr/sbin/ntpd") == 0)
+    CatalogSnapshot *snap = (CatalogSnapshot *) data;
+    CatEntry *e;
+    int i;
+
+    // a newer load has been started since, or there is nothing to show
+    if (snap->gen != load_gen)
     {
-        if (system ("ntpq -p | grep -q ^\\*") == 0) return TRUE;
+        free_snapshot (snap);
+        return FALSE;
     }
-    else
+    if (!snap->catalog) return load_done (snap);
+
+    // finding the files is quick, as the theme is indexed; it is reading and scaling them which takes the time
+    snap->paths = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    icon_path (snap, "application-x-executable");
+    if (snap->add_cats) icon_path (snap, "rpi");
+    for (i = 0; i < snap->catalog->entries->len; i++)
     {
-        if (system ("timedatectl status | grep -q \"synchronized: yes\"") == 0) return TRUE;
+        e = g_ptr_array_index (snap->catalog->entries, i);
+        if (e->flags & ENTRY_HIDDEN) continue;
+        if (e->str[CF_ICON]) icon_path (snap, e->str[CF_ICON]);
+        if (snap->add_cats && e->str[CF_CATEGORY]) icon_path (snap, cat_icon_name ((char *) e->str[CF_CATEGORY]));
     }
+    g_thread_unref (g_thread_new ("icons", icon_thread, snap));
     return FALSE;
 }
 
-static void resync (void)
+static void icon_path (CatalogSnapshot *snap, const gchar *name)
 {
-    if (system ("test -e /usr/sbin/ntpd") == 0)
-    {
-        system ("/etc/init.d/ntp stop; ntpd -gq; /etc/init.d/ntp start");
-    }
-    else
+    GtkIconInfo *info;
+
+    // a category outside the fixed list, say from a local fragment, has no icon name
+    if (!name || g_hash_table_contains (snap->paths, name)) return;
+    info = gtk_icon_theme_lookup_icon (gtk_icon_theme_get_default (), name, 32, 0);
+    g_hash_table_insert (snap->paths, (gpointer) name, info ? g_strdup (gtk_icon_info_get_filename (info)) : NULL);
+    if (info) gtk_icon_info_free (info);
+}
+
+static gpointer icon_thread (gpointer data)
+{
+    CatalogSnapshot *snap = (CatalogSnapshot *) data;
+    GHashTableIter iter;
+    GdkPixbuf *icon;
+    gpointer name, path;
+
+    snap->icons = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
+    g_hash_table_iter_init (&iter, snap->paths);
+    while (g_hash_table_iter_next (&iter, &name, &path))
     {
-        system ("systemctl -q stop systemd-timesyncd 2> /dev/null; systemctl -q start systemd-timesyncd 2> /dev/null");
+        icon = path ? gdk_pixbuf_new_from_file_at_size (path, 32, 32, NULL) : NULL;
+        if (icon) g_hash_table_insert (snap->icons, name, icon);
     }
+
+    gdk_threads_add_idle (load_done, snap);
+    return NULL;
 }
 
-static gboolean ntp_check (gpointer data)
+static gboolean load_done (gpointer data)
 {
-    gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
-    if (clock_synced ())
+    CatalogSnapshot *snap = (CatalogSnapshot *) data;
+    GtkListStore *old_packages, *old_categories = NULL;
+    GtkTreeIter cat_entry;
+    PkTask *task;
+    CatEntry *e;
+    int i;
+
+    // a newer load has been started since
+    if (snap->gen != load_gen)
     {
-        g_idle_add (update_self, NULL);
+        free_snapshot (snap);
         return FALSE;
     }
-    // trigger a resync
-    if (calls == 0) resync ();
+    loading = FALSE;
 
-    if (calls++ > 120)
+    if (!snap->catalog)
     {
-        error_box (_("Error synchronising clock - could not sync with time server"), TRUE);
+        // handle no data file here...
+        free_snapshot (snap);
+        error_box (_("Unable to open package data file"), TRUE);
         return FALSE;
     }
 
+    // build the new lists from the catalog and the decoded icons
+    snap->packages = packages_store_new ();
+    if (snap->add_cats)
+    {
+        snap->categories = categories_store_new ();
+        gtk_list_store_append (snap->categories, &cat_entry);
+        gtk_list_store_set (snap->categories, &cat_entry, CAT_ICON, snapshot_icon (snap, "rpi"), CAT_NAME, "All Programs", CAT_DISP_NAME, _("All Programs"), -1);
+    }
+    for (i = 0; i < snap->catalog->entries->len; i++)
+    {
+        e = g_ptr_array_index (snap->catalog->entries, i);
+        if (!(e->flags & ENTRY_HIDDEN)) add_entry (snap, e);
+    }
+
+    // swap in the new lists and show them, then free the old ones and the catalog they pointed into
+    old_packages = packages;
+    packages = snap->packages;
+    if (snap->add_cats)
+    {
+        old_categories = categories;
+        categories = snap->categories;
+    }
+    show_packages ();
+    g_object_unref (old_packages);
+    if (old_categories) g_object_unref (old_categories);
+
+    free_catalog ();
+    catalog = snap->catalog;
+    resolve_names = snap->names;
+    snap->packages = snap->categories = NULL;
+    snap->catalog = NULL;
+    snap->names = NULL;
+    free_snapshot (snap);
+
+    if (load_waiting)
+    {
+        task = load_waiting;
+        load_waiting = NULL;
+        start_resolve (task);
+    }
+    return FALSE;
+}
+
+static void free_snapshot (CatalogSnapshot *snap)
+{
+    if (snap->packages) g_object_unref (snap->packages);
+    if (snap->categories) g_object_unref (snap->categories);
+    if (snap->paths) g_hash_table_destroy (snap->paths);
+    if (snap->icons) g_hash_table_destroy (snap->icons);
+    g_free (snap->names);
+    prefapps_catalog_free (snap->catalog);
+    g_free (snap->loc);
+    g_free (snap);
+}
+
+static GtkListStore *packages_store_new (void)
+{
+    return gtk_list_store_new (21, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_POINTER,
+        G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+        G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_POINTER, G_TYPE_STRING,
+        G_TYPE_BOOLEAN, G_TYPE_POINTER, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_STRING);
+}
+
+static GtkListStore *categories_store_new (void)
+{
+    return gtk_list_store_new (3, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING);
+}
+
+static GdkPixbuf *snapshot_icon (CatalogSnapshot *snap, const gchar *name)
+{
+    GdkPixbuf *icon;
+
+    // an icon with no file of its own, such as one built into GTK, is loaded here instead; it belongs to the table
+    // either way, so the caller doesn't free it
+    if (!name) return NULL;
+    if (g_hash_table_lookup_extended (snap->icons, name, NULL, (gpointer *) &icon)) return icon;
+    icon = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (), name, 32, 0, NULL);
+    if (icon) g_hash_table_insert (snap->icons, (gpointer) name, icon);
+    return icon;
+}
+
+static void add_entry (CatalogSnapshot *snap, const CatEntry *e)
+{
+    GtkTreeIter entry, cat_entry;
+    GdkPixbuf *icon;
+    gchar *buf;
+    const gchar *cat = e->str[CF_CATEGORY], *adds = e->str[CF_ADDITIONAL];
+    gboolean new;
+
+    // add unique entries to category list
+    if (snap->add_cats)
+    {
+        new = TRUE;
+        gtk_tree_model_get_iter_first (GTK_TREE_MODEL (snap->categories), &cat_entry);
+        while (gtk_tree_model_iter_next (GTK_TREE_MODEL (snap->categories), &cat_entry))
+        {
+            gtk_tree_model_get (GTK_TREE_MODEL (snap->categories), &cat_entry, CAT_NAME, &buf, -1);
+            if (!g_strcmp0 (cat, buf))
+            {
+                new = FALSE;
+                g_free (buf);
+                break;
+            }
+            g_free (buf);
+        }
+
+        if (new)
+        {
+            gtk_list_store_append (snap->categories, &cat_entry);
+            gtk_list_store_set (snap->categories, &cat_entry, CAT_ICON, snapshot_icon (snap, cat_icon_name ((char *) cat)), CAT_NAME, cat, CAT_DISP_NAME, _(cat), -1);
+        }
+    }
+
+    // create the entry for the packages list
+    icon = snapshot_icon (snap, e->str[CF_ICON]);
+    if (!icon) icon = snapshot_icon (snap, "application-x-executable");
+    gtk_list_store_append (snap->packages, &entry);
+    gtk_list_store_set (snap->packages, &entry,
+        PACK_ICON, icon,
+        PACK_INSTALLED, FALSE,
+        PACK_INIT_INST, FALSE,
+        PACK_CATEGORY, cat,
+        PACK_PACKAGE_NAME, e->str[CF_PACKAGE],
+        PACK_PACKAGE_ID, "none",
+        PACK_RPACKAGE_NAME, e->str[CF_RPACKAGE],
+        PACK_RPACKAGE_ID, "none",
+        PACK_CELL_NAME, e->str[CF_NAME],
+        PACK_CELL_DESC, e->str[CF_DESCRIPTION],
+        PACK_ADD_NAMES, adds,
+        PACK_ADD_IDS, "none",
+        PACK_REBOOT, (e->flags & CATALOG_REBOOT) != 0,
+        PACK_ARCH, e->str[CF_ARCH] ? e->str[CF_ARCH] : "any",
+        PACK_RPDESC, (e->flags & CATALOG_RPDESC) != 0,
+        PACK_QUEUED, FALSE,
+        PACK_UPDATE_ID, "none",
+        -1);
+    set_cell_text (snap->packages, &entry);
+}
+
+static gboolean start_resolve (gpointer data)
+{
+    message (_("Finding packages - please wait..."), 0 , -1);
+
+    start_stage (STAGE_RESOLVE, start_resolve, data);
+
+    // start again from the first chunk - anything still arriving from an earlier attempt is dropped
+    resolve_reset ();
+    resolve_gen++;
+    resolve_task = PK_TASK (data);
+    resolve_count = g_strv_length (resolve_names);
+    resolve_rows = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, free_rows);
+    resolve_found = g_ptr_array_new_with_free_func (g_object_unref);
+    resolve_queue = g_queue_new ();
+    index_rows ();
+
+    // ask the service first, as it will usually have all of these already
+    if (use_service)
+    {
+        gchar *names = g_strjoinv (" ", resolve_names);
+        gchar *req = g_strdup_printf ("RESOLVE %s\n", names);
+        gboolean sent = service_call (req, PK_TASK (data), cancellable, resolve_service_done);
+        g_free (req);
+        g_free (names);
+        if (sent) return FALSE;
+    }
+    resolve_send ();
+    resolve_check ();
+    return FALSE;
+}
+
+static void resolve_send (void)
+{
+    ResolveChunk *chunk;
+    guint n;
+
+    // keep up to RESOLVE_PARALLEL transactions running, so one is being answered while the next is looked up
+    while (resolve_running < RESOLVE_PARALLEL && resolve_next < resolve_count)
+    {
+        n = MIN (RESOLVE_CHUNK, resolve_count - resolve_next);
+        chunk = g_new0 (ResolveChunk, 1);
+        chunk->names = g_new0 (gchar *, n + 1);
+        memcpy (chunk->names, resolve_names + resolve_next, n * sizeof (gchar *));
+        chunk->gen = resolve_gen;
+        chunk->tx = tx_begin ("resolve", "packagekit", chunk->names);
+        resolve_next += n;
+        resolve_running++;
+        pk_client_resolve_async (PK_CLIENT (resolve_task), 0, chunk->names, cancellable, (PkProgressCallback) resolve_progress, chunk,
+            (GAsyncReadyCallback) resolve_2_done, chunk);
+    }
+}
+
+static void resolve_progress (PkProgress *prog, PkProgressType *type, gpointer data)
+{
+    ResolveChunk *chunk = (ResolveChunk *) data;
+    PkPackage *item;
+
+    progress (prog, type, chunk->tx);
+
+    // each package is taken as it arrives, rather than waiting for the whole chunk
+    if ((PkProgressType) GPOINTER_TO_INT (type) != PK_PROGRESS_TYPE_PACKAGE || chunk->gen != resolve_gen) return;
+    g_object_get (prog, "package", &item, NULL);
+    if (!item) return;
+
+    // with a bundle, only what is installed is used - everything else comes from the bundle
+    if (filter_fn (item, NULL) && (!bundle || pk_package_get_info (item) == PK_INFO_ENUM_INSTALLED)) queue_package (item);
+    g_object_unref (item);
+}
+
+static void resolve_service_done (PkTask *task, GPtrArray *lines)
+{
+    PkPackage *item;
+    gchar **fields;
+    int i;
+
+    if (!lines)
+    {
+        resolve_send ();
+        resolve_check ();
+        return;
+    }
+
+    // each line is PACKAGE <info> <id> - rebuild the packages which a direct resolve would have returned
+    for (i = 0; i < lines->len; i++)
+    {
+        fields = g_strsplit (g_ptr_array_index (lines, i), " ", 3);
+        if (g_strv_length (fields) == 3 && !g_strcmp0 (fields[0], "PACKAGE"))
+        {
+            item = pk_package_new ();
+            if (pk_package_set_id (item, fields[2], NULL))
+            {
+                g_object_set (item, "info", atoi (fields[1]), NULL);
+                if (filter_fn (item, NULL) && (!bundle || pk_package_get_info (item) == PK_INFO_ENUM_INSTALLED)) queue_package (item);
+            }
+            g_object_unref (item);
+        }
+        g_strfreev (fields);
+    }
+    if (bundle) bundle_resolve (resolve_names);
+
+    // the service answered for every name at once
+    resolve_next = resolve_count;
+    resolve_check ();
+}
+
+static void resolve_2_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    ResolveChunk *chunk = (ResolveChunk *) data;
+    PkResults *results;
+    GError *error = NULL;
+    guint gen = resolve_gen;
+
+    if (chunk->gen != resolve_gen)
+    {
+        // part of an attempt which has since been abandoned - only record it
+        results = pk_task_generic_finish (task, res, &error);
+        tx_finish (chunk->tx, results, error);
+        if (results) g_object_unref (results);
+        if (error) g_error_free (error);
+        g_free (chunk->names);
+        g_free (chunk);
+        return;
+    }
+
+    resolve_running--;
+    results = error_handler (task, res, chunk->tx, _("finding packages"), FALSE, TRUE);
+    if (!results)
+    {
+        // the first chunk to fail decides what happens next; the rest are dropped
+        if (resolve_gen == gen) resolve_gen++;
+        g_free (chunk->names);
+        g_free (chunk);
+        return;
+    }
+    g_object_unref (results);
+
+    // the packages themselves were queued as they arrived
+    if (bundle) bundle_resolve (chunk->names);
+    g_free (chunk->names);
+    g_free (chunk);
+
+    resolve_send ();
+    resolve_check ();
+}
+
+static void queue_package (PkPackage *item)
+{
+    g_queue_push_tail (resolve_queue, g_object_ref (item));
+    if (!resolve_idle) resolve_idle = g_idle_add (merge_resolved, NULL);
+}
+
+static gboolean merge_resolved (gpointer data)
+{
+    PkPackage *item;
+    int i;
+
+    // only a slice of the packages at a time, so that the list stays responsive while a large catalog resolves
+    for (i = 0; i < RESOLVE_SLICE && (item = g_queue_pop_head (resolve_queue)); i++)
+    {
+        merge_package (item);
+        g_ptr_array_add (resolve_found, item);
+    }
+    if (!g_queue_is_empty (resolve_queue)) return TRUE;
+
+    resolve_idle = 0;
+    resolve_check ();
+    return FALSE;
+}
+
+static void merge_package (PkPackage *item)
+{
+    GtkTreeIter *iter;
+    GSList *rows;
+    gboolean inst, installed;
+    gchar *pack, *rpack, *arch, *curr_id;
+    const gchar *package_id = pk_package_get_id (item);
+
+    // An installed version always wins, whether of the package or the rpackage. Otherwise, an entry which is not
+    // installed takes the ID for its architecture, preferring arm64 over armhf if both are offered.
+    installed = pk_package_get_info (item) == PK_INFO_ENUM_INSTALLED;
+    for (rows = g_hash_table_lookup (resolve_rows, pk_package_get_name (item)); rows; rows = rows->next)
+    {
+        iter = (GtkTreeIter *) rows->data;
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), iter, PACK_INIT_INST, &inst, PACK_PACKAGE_NAME, &pack, PACK_RPACKAGE_NAME, &rpack,
+            PACK_ARCH, &arch, PACK_PACKAGE_ID, &curr_id, -1);
+
+        if (installed && prefapps_match_pid (pack, package_id))
+        {
+            gtk_list_store_set (packages, iter, PACK_PACKAGE_ID, package_id, PACK_INSTALLED, TRUE, PACK_INIT_INST, TRUE, -1);
+            g_free (curr_id);
+            break;
+        }
+        if (installed && prefapps_match_pid (rpack, package_id))
+        {
+            // an uninstalled package ID which arrived first is not wanted for an entry installed as its rpackage
+            gtk_list_store_set (packages, iter, PACK_RPACKAGE_ID, package_id, PACK_INSTALLED, TRUE, PACK_INIT_INST, TRUE, -1);
+            if (!inst) gtk_list_store_set (packages, iter, PACK_PACKAGE_ID, "none", -1);
+            g_free (curr_id);
+            break;
+        }
+        if (!installed && !inst && prefapps_match_pid (pack, package_id) && prefapps_match_arch (arch))
+        {
+            if (!g_strcmp0 (curr_id, "none") || strstr (package_id, "arm64"))
+                gtk_list_store_set (packages, iter, PACK_PACKAGE_ID, package_id, -1);
+            g_free (curr_id);
+            break;
+        }
+        g_free (curr_id);
+    }
+}
+
+static void resolve_check (void)
+{
+    GtkTreeIter iter;
+    GHashTable *best;
+    GString *addlist;
+    gboolean valid;
+    gchar *curr, *addpks, **adds;
+    int j;
+
+    // done once every chunk has been sent and answered, and all that was found has been merged into the list
+    if (resolve_next < resolve_count || resolve_running || resolve_idle) return;
+
+    // Choose exactly one ID for each package name, for use with additional packages. An installed version
+    // always wins; otherwise the same arm64-over-armhf rule is used as for the main package IDs.
+    best = prefapps_best_ids (resolve_found);
+
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_ADD_NAMES, &addpks, -1);
+        if (addpks && *addpks)
+        {
+            addlist = g_string_new (NULL);
+            adds = prefapps_expand_additional (addpks, lang, lang_loc);
+            for (j = 0; adds[j]; j++)
+            {
+                curr = g_hash_table_lookup (best, adds[j]);
+                if (!curr) continue;
+                if (addlist->len) g_string_append_c (addlist, ',');
+                g_string_append (addlist, curr);
+            }
+            gtk_list_store_set (packages, &iter, PACK_ADD_IDS, addlist->len ? addlist->str : "none", -1);
+            g_string_free (addlist, TRUE);
+            g_strfreev (adds);
+        }
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    g_hash_table_destroy (best);
+    resolve_reset ();
+
+    // descriptions are only needed for what the user can see, so fetch them later
+    packages_resolved ();
+}
+
+static void index_rows (void)
+{
+    GtkTreeIter iter;
+    GSList *rows;
+    gboolean valid;
+    gchar *pack, *rpack;
+
+    // each package and rpackage name points to the entries using it, in list order
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_NAME, &pack, PACK_RPACKAGE_NAME, &rpack, -1);
+        if (pack)
+        {
+            rows = g_hash_table_lookup (resolve_rows, pack);
+            if (rows) g_slist_append (rows, gtk_tree_iter_copy (&iter));
+            else g_hash_table_insert (resolve_rows, pack, g_slist_append (NULL, gtk_tree_iter_copy (&iter)));
+        }
+        if (rpack && g_strcmp0 (rpack, pack))
+        {
+            rows = g_hash_table_lookup (resolve_rows, rpack);
+            if (rows) g_slist_append (rows, gtk_tree_iter_copy (&iter));
+            else g_hash_table_insert (resolve_rows, rpack, g_slist_append (NULL, gtk_tree_iter_copy (&iter)));
+        }
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+}
+
+static void free_rows (gpointer data)
+{
+    g_slist_free_full ((GSList *) data, (GDestroyNotify) gtk_tree_iter_free);
+}
+
+static void resolve_reset (void)
+{
+    // the row index points into the packages list store, so must go whenever that is cleared
+    if (resolve_idle) g_source_remove (resolve_idle);
+    resolve_idle = 0;
+    if (resolve_queue) g_queue_free_full (resolve_queue, g_object_unref);
+    resolve_queue = NULL;
+    if (resolve_found) g_ptr_array_unref (resolve_found);
+    resolve_found = NULL;
+    if (resolve_rows) g_hash_table_destroy (resolve_rows);
+    resolve_rows = NULL;
+    resolve_next = resolve_count = 0;
+    resolve_running = 0;
+}
+
+static int category_sort (GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer userdata)
+{
+    gchar *name1, *name2;
+    int ret;
+
+    gtk_tree_model_get (model, a, CAT_DISP_NAME, &name1, -1);
+    gtk_tree_model_get (model, b, CAT_DISP_NAME, &name2, -1);
+
+    if (!g_strcmp0 (name1, _("All Programs"))) ret = -1;
+    else if (!g_strcmp0 (name2, _("All Programs"))) ret = 1;
+    else ret = g_strcmp0 (name1, name2);
+
+    g_free (name1);
+    g_free (name2);
+
+    return ret;
+}
+
+static void set_fixed_rows (gboolean fixed)
+{
+    GtkTreeViewColumn *col;
+    GtkCellRenderer *crt;
+    PangoFontMetrics *metrics;
+    GList *cells;
+    int ypad, height;
+
+    col = gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 1);
+    cells = gtk_cell_layout_get_cells (GTK_CELL_LAYOUT (col));
+    crt = GTK_CELL_RENDERER (cells->data);
+    g_list_free (cells);
+
+    gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (pack_tv), FALSE);
+    if (fixed)
+    {
+        // Every row is one line of name and one of description, ellipsized rather than wrapped, so all rows have
+        // the same height and GTK only needs to lay out the rows in view. The full description is in the tooltip.
+        metrics = pango_context_get_metrics (gtk_widget_get_pango_context (pack_tv), gtk_widget_get_style (pack_tv)->font_desc, NULL);
+        g_object_get (crt, "ypad", &ypad, NULL);
+        height = 2 * PANGO_PIXELS (pango_font_metrics_get_ascent (metrics) + pango_font_metrics_get_descent (metrics)) + 2 * ypad;
+        pango_font_metrics_unref (metrics);
+
+        g_object_set (crt, "wrap-width", -1, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+        gtk_cell_renderer_set_fixed_size (crt, -1, MAX (height, 36));
+        gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_FIXED);
+        gtk_tree_view_column_set_fixed_width (col, 320);
+        gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (pack_tv), TRUE);
+    }
+    else
+    {
+        g_object_set (crt, "wrap-width", 320, "ellipsize", PANGO_ELLIPSIZE_NONE, NULL);
+        gtk_cell_renderer_set_fixed_size (crt, -1, -1);
+        gtk_tree_view_column_set_sizing (col, GTK_TREE_VIEW_COLUMN_GROW_ONLY);
+    }
+}
+
+static void show_packages (void)
+{
+    GtkTreeIter iter;
+    GtkTreeModel *scateg, *fcateg, *spackages, *fpackages;
+
+    // catalog now loaded - set up filtered and sorted package list
+    set_fixed_rows (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (packages), NULL) >= fixed_rows_above);
+    spackages = gtk_tree_model_sort_new_with_model (GTK_TREE_MODEL (packages));
+    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (spackages), PACK_CELL_NAME, GTK_SORT_ASCENDING);
+    fpackages = gtk_tree_model_filter_new (GTK_TREE_MODEL (spackages), NULL);
+    gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (fpackages), (GtkTreeModelFilterVisibleFunc) match_category, NULL, NULL);
+    gtk_tree_view_set_model (GTK_TREE_VIEW (pack_tv), GTK_TREE_MODEL (fpackages));
+
+    // the view now holds the only reference, so replacing its model on a reload frees the old chain and its store
+    g_object_unref (fpackages);
+    g_object_unref (spackages);
+
+    // set up filtered and sorted category list
+    scateg = gtk_tree_model_sort_new_with_model (GTK_TREE_MODEL (categories));
+    gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (scateg), CAT_NAME, category_sort, NULL, NULL);
+    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (scateg), CAT_NAME, GTK_SORT_ASCENDING);
+    fcateg = gtk_tree_model_filter_new (GTK_TREE_MODEL (scateg), NULL);
+    gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (fcateg), (GtkTreeModelFilterVisibleFunc) packs_in_cat, NULL, NULL);
+    gtk_tree_view_set_model (GTK_TREE_VIEW (cat_tv), GTK_TREE_MODEL (fcateg));
+    g_object_unref (fcateg);
+    g_object_unref (scateg);
+
+    // select category
+    gtk_tree_model_get_iter_from_string (GTK_TREE_MODEL (fcateg), &iter, sel_cat);
+    gtk_tree_selection_select_iter (gtk_tree_view_get_selection (GTK_TREE_VIEW (cat_tv)), &iter);
+
+    // the list can be browsed while its packages are found, but nothing can be applied until they have been
+    gtk_widget_set_sensitive (close_btn, TRUE);
+    gtk_widget_set_sensitive (apply_btn, !pending);
+
+    if (msg_dlg)
+    {
+        gtk_widget_destroy (GTK_WIDGET (msg_dlg));
+        msg_dlg = NULL;
+    }
+}
+
+static void packages_resolved (void)
+{
+    GtkTreeIter iter;
+    gboolean valid;
+
+    // show the install state of each entry now that it is known
+    pending = FALSE;
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        update_cell_text (&iter);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    gtk_label_set_text (GTK_LABEL (size_lbl), "");
+    gtk_widget_set_sensitive (apply_btn, TRUE);
+
+    stage_active = FALSE;
+    if (msg_dlg)
+    {
+        gtk_widget_destroy (GTK_WIDGET (msg_dlg));
+        msg_dlg = NULL;
+    }
+
+    queue_details ();
+    check_updates ();
+
+    // offer to finish anything left over from a previous run which was interrupted
+    if (!journal_checked)
+    {
+        journal_checked = TRUE;
+        journal_resume ();
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Lazy loading of package details                                            */
+/*----------------------------------------------------------------------------*/
+
+static gchar *details_name (GtkTreeModel *model, GtkTreeIter *iter)
+{
+    gchar *id, *rid, *name;
+    gboolean rpdesc;
+
+    // the one package whose description is shown for an entry - returns its name, or NULL if it has no ID
+    gtk_tree_model_get (model, iter, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_RPDESC, &rpdesc, -1);
+    if ((rpdesc || !g_strcmp0 (id, "none")) && g_strcmp0 (rid, "none"))
+    {
+        g_free (id);
+        id = rid;
+    }
+    else g_free (rid);
+
+    if (!g_strcmp0 (id, "none")) name = NULL;
+    else name = g_strndup (id, strcspn (id, ";"));
+    g_free (id);
+    return name;
+}
+
+static void queue_details (void)
+{
+    if (!det_idle) det_idle = g_idle_add (fetch_details, NULL);
+}
+
+static gboolean fetch_details (gpointer data)
+{
+    GtkTreeModel *model;
+    GtkTreePath *start, *end, *path;
+    GtkTreeIter iter;
+    GPtrArray *ids;
+    GHashTable *local = NULL;
+    BundlePkg *pkg;
+    TxLog *tx;
+    gboolean valid, last;
+    gchar *name, *desc, *id, *rid, *cid, *text;
+    gboolean rpdesc;
+
+    det_idle = 0;
+    if (!gtk_tree_view_get_visible_range (GTK_TREE_VIEW (pack_tv), &start, &end)) return FALSE;
+
+    if (!det_cancel) det_cancel = g_cancellable_new ();
+    if (!det_requested) det_requested = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    // one ID per visible entry which has no description yet and hasn't already been asked for
+    ids = g_ptr_array_new_with_free_func (g_free);
+    model = gtk_tree_view_get_model (GTK_TREE_VIEW (pack_tv));
+    valid = gtk_tree_model_get_iter (model, &iter, start);
+    while (valid)
+    {
+        gtk_tree_model_get (model, &iter, PACK_DESCRIPTION, &desc, -1);
+        name = desc ? NULL : details_name (model, &iter);
+        if (name && !g_hash_table_lookup (det_requested, name))
+        {
+            gtk_tree_model_get (model, &iter, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_RPDESC, &rpdesc, -1);
+            cid = ((rpdesc || !g_strcmp0 (id, "none")) && g_strcmp0 (rid, "none")) ? rid : id;
+            if ((pkg = bundle_lookup (cid)))
+            {
+                // packages from a bundle are described by its index
+                if (!local) local = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+                if ((text = prefapps_details_text (pkg->summary, pkg->description))) g_hash_table_replace (local, g_strdup (name), text);
+            }
+            else g_ptr_array_add (ids, g_strdup (cid));
+            g_hash_table_insert (det_requested, name, GINT_TO_POINTER (TRUE));
+            g_free (id);
+            g_free (rid);
+        }
+        else g_free (name);
+        g_free (desc);
+
+        path = gtk_tree_model_get_path (model, &iter);
+        last = gtk_tree_path_compare (path, end) >= 0;
+        gtk_tree_path_free (path);
+        if (last) break;
+        valid = gtk_tree_model_iter_next (model, &iter);
+    }
+    gtk_tree_path_free (start);
+    gtk_tree_path_free (end);
+    if (local) apply_details (local);
+
+    if (ids->len)
+    {
+        g_ptr_array_add (ids, NULL);
+        if (use_service)
+        {
+            gchar *list = g_strjoinv (" ", (gchar **) ids->pdata);
+            gchar *req = g_strdup_printf ("DETAILS %s\n", list);
+            gboolean sent = service_call (req, NULL, det_cancel, details_service_done);
+            g_free (req);
+            g_free (list);
+            if (sent)
+            {
+                g_ptr_array_unref (ids);
+                return FALSE;
+            }
+        }
+        tx = tx_begin ("details", "packagekit", (gchar **) ids->pdata);
+        pk_client_get_details_async (PK_CLIENT (session), (gchar **) ids->pdata, det_cancel, (PkProgressCallback) tx_progress, tx, (GAsyncReadyCallback) details_done, tx);
+    }
+    g_ptr_array_unref (ids);
+    return FALSE;
+}
+
+static void details_done (PkClient *client, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+    PkDetails *item;
+    GPtrArray *array;
+    GHashTable *descs;
+    GError *error = NULL;
+    gchar *desc;
+    const gchar *package_id;
+    int i;
+
+    // descriptions are only cosmetic - if they can't be read, allow them to be asked for again
+    results = pk_client_generic_finish (client, res, &error);
+    tx_finish ((TxLog *) data, results, error);
+    if (error) g_error_free (error);
+    if (!results || pk_results_get_error_code (results))
+    {
+        if (results) g_object_unref (results);
+        if (det_requested && !g_cancellable_is_cancelled (det_cancel)) g_hash_table_remove_all (det_requested);
+        return;
+    }
+
+    // build and escape each description once, keyed by package name
+    descs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    array = pk_results_get_details_array (results);
+    for (i = 0; i < array->len; i++)
+    {
+        item = g_ptr_array_index (array, i);
+        package_id = pk_details_get_package_id (item);
+        desc = prefapps_details_text (pk_details_get_summary (item), pk_details_get_description (item));
+        if (desc) g_hash_table_replace (descs, g_strndup (package_id, strcspn (package_id, ";")), desc);
+    }
+    g_ptr_array_unref (array);
+    g_object_unref (results);
+
+    apply_details (descs);
+}
+
+static void details_service_done (PkTask *task, GPtrArray *lines)
+{
+    // the service has gone away - forget what was asked for, so the visible entries are fetched directly instead
+    if (!lines)
+    {
+        if (det_requested && !g_cancellable_is_cancelled (det_cancel))
+        {
+            g_hash_table_remove_all (det_requested);
+            queue_details ();
+        }
+        return;
+    }
+
+    apply_details (prefapps_details_parse (lines));
+}
+
+static void apply_details (GHashTable *descs)
+{
+    GtkTreeIter iter;
+    gboolean valid;
+    gchar *desc, *name;
+
+    // a single pass over the entries to fill them in
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        name = details_name (GTK_TREE_MODEL (packages), &iter);
+        if (name && (desc = g_hash_table_lookup (descs, name)))
+            gtk_list_store_set (packages, &iter, PACK_DESCRIPTION, desc, -1);
+        g_free (name);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    g_hash_table_destroy (descs);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Handlers for asynchronous install and remove sequence                      */
+/*----------------------------------------------------------------------------*/
+
+static Batch *get_selection (void)
+{
+    GtkTreeIter iter;
+    GPtrArray *inst, *uninst;
+    Batch *b;
+    gboolean valid, state, init, reboot, queued;
+    gchar *id, *rid, *addid;
+
+    // entries already waiting in a batch are left out, as they can't be changed until it is done
+    b = g_new0 (Batch, 1);
+    inst = g_ptr_array_new ();
+    uninst = g_ptr_array_new ();
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INSTALLED, &state, PACK_INIT_INST, &init, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_ADD_IDS, &addid, PACK_REBOOT, &reboot, PACK_QUEUED, &queued, -1);
+        if (!queued && init != state)
+        {
+            if (prefapps_selection_add (inst, uninst, init, state, id, rid, addid) && reboot) b->reboot = TRUE;
+            b->rows = g_slist_prepend (b->rows, gtk_tree_iter_copy (&iter));
+        }
+        g_free (id);
+        g_free (rid);
+        g_free (addid);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+
+    b->n_inst = inst->len;
+    b->n_uninst = uninst->len;
+    g_ptr_array_add (inst, NULL);
+    g_ptr_array_add (uninst, NULL);
+    b->inst = (gchar **) g_ptr_array_free (inst, FALSE);
+    b->uninst = (gchar **) g_ptr_array_free (uninst, FALSE);
+    return b;
+}
+
+static void free_batch (Batch *b)
+{
+    g_strfreev (b->inst);
+    g_strfreev (b->uninst);
+    g_strfreev (b->update);
+    g_slist_free_full (b->rows, (GDestroyNotify) gtk_tree_iter_free);
+    if (b->done) g_ptr_array_unref (b->done);
+    if (b->task) g_object_unref (b->task);
+    g_free (b);
+}
+
+static void install_handler (GtkButton* btn, gpointer ptr)
+{
+    Batch *b;
+    GSList *rows;
+
+    // don't start anything which the space estimate says will not fit
+    if (est_short) return;
+
+    // any estimate still in progress is now irrelevant
+    if (est_timer) g_source_remove (est_timer);
+    est_timer = 0;
+    if (est_cancel) g_cancellable_cancel (est_cancel);
+
+    b = get_selection ();
+    if (!b->n_inst && !b->n_uninst)
+    {
+        free_batch (b);
+        return;
+    }
+
+    // the entries in the batch are fixed until it is done, but others can be chosen and queued meanwhile
+    for (rows = b->rows; rows; rows = rows->next)
+    {
+        gtk_list_store_set (packages, (GtkTreeIter *) rows->data, PACK_QUEUED, TRUE, PACK_SIZE, NULL, -1);
+        update_cell_text ((GtkTreeIter *) rows->data);
+    }
+    gtk_label_set_text (GTK_LABEL (size_lbl), "");
+
+    queue_batch (b);
+}
+
+static void queue_batch (Batch *b)
+{
+    if (!batches) batches = g_queue_new ();
+    g_queue_push_tail (batches, b);
+    journal_save ();
+    if (!batch) next_batch ();
+}
+
+static void next_batch (void)
+{
+    // batches are run one at a time, in the order in which they were applied
+    batch = (Batch *) g_queue_pop_head (batches);
+    if (!batch) return;
+    journal_save ();
+    gtk_widget_set_visible (bg_btn, TRUE);
+
+    can_cancel = TRUE;
+    start_batch (NULL);
+}
+
+static gboolean start_batch (gpointer data)
+{
+    if (lock_wait (start_batch, NULL)) return FALSE;
+
+    if (batch->n_inst && batch->n_uninst)
+    {
+        // PackageKit has no role for a mixed transaction, so hand both sets to apt in one pass
+        apt_transaction (batch);
+        return FALSE;
+    }
+
+    // the shared client may still be set up for the local files of an earlier bundle install
+    batch->task = g_object_ref (session);
+    g_object_set (batch->task, "only-trusted", TRUE, NULL);
+    if (batch->n_update) start_update (batch);
+    else if (batch->n_inst) start_install (batch);
+    else start_remove (batch);
+    return FALSE;
+}
+
+static gboolean start_install (gpointer data)
+{
+    Batch *b = (Batch *) data;
+    TxLog *tx;
+    gchar **files;
+
+    message (_("Installing packages - please wait..."), 0 , -1);
+
+    start_stage (STAGE_INSTALL, start_install, data);
+    if (bundle)
+    {
+        // local files carry no repository signature, so they can't be limited to trusted packages
+        files = bundle_files (b->inst);
+        g_object_set (b->task, "only-trusted", FALSE, NULL);
+        tx = tx_begin ("install", "packagekit", files);
+        pk_task_install_files_async (b->task, files, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) install_done, tx);
+        g_strfreev (files);
+        return FALSE;
+    }
+    tx = tx_begin ("install", "packagekit", b->inst);
+    pk_task_install_packages_async (b->task, b->inst, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) install_done, tx);
+    return FALSE;
+}
+
+static gboolean start_remove (gpointer data)
+{
+    Batch *b = (Batch *) data;
+    TxLog *tx;
+
+    message (_("Removing packages - please wait..."), 0 , -1);
+
+    start_stage (STAGE_REMOVE, start_remove, data);
+    tx = tx_begin ("remove", "packagekit", b->uninst);
+    pk_task_remove_packages_async (b->task, b->uninst, TRUE, TRUE, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) remove_done, tx);
+    return FALSE;
+}
+
+static void install_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+
+    results = error_handler (task, res, (TxLog *) data, _("installing packages"), FALSE, FALSE);
+    if (!results)
+    {
+        if (!retry_id) drop_batches ();
+        return;
+    }
+    g_object_unref (results);
+
+    if (batch->n_uninst) start_remove (batch);
+    else batch_done (_("Installation complete"));
+}
+
+static void remove_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+
+    results = error_handler (task, res, (TxLog *) data, _("removing packages"), FALSE, FALSE);
+    if (!results)
+    {
+        if (!retry_id) drop_batches ();
+        return;
+    }
+    g_object_unref (results);
+
+    if (batch->n_inst)
+        batch_done (_("Installation and removal complete"));
+    else
+        batch_done (_("Removal complete"));
+}
+
+static void batch_done (const char *msg)
+{
+    Batch *b;
+    GSList *rows;
+    gboolean state, idle;
+
+    // the entries in the batch now show their new state
+    stage_active = FALSE;
+    for (rows = batch->rows; rows; rows = rows->next)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), (GtkTreeIter *) rows->data, PACK_INSTALLED, &state, -1);
+        gtk_list_store_set (packages, (GtkTreeIter *) rows->data, PACK_INIT_INST, state, PACK_QUEUED, FALSE, -1);
+        if (batch->n_update) gtk_list_store_set (packages, (GtkTreeIter *) rows->data, PACK_UPDATE_ID, "none", -1);
+        update_cell_text ((GtkTreeIter *) rows->data);
+    }
+    update_button ();
+    if (batch->reboot) needs_reboot = TRUE;
+    free_batch (batch);
+    batch = NULL;
+
+    if (!g_queue_is_empty (batches))
+    {
+        next_batch ();
+        return;
+    }
+    journal_save ();
+    gtk_widget_set_visible (bg_btn, FALSE);
+
+    if (detached)
+    {
+        notify (msg, needs_reboot ? _("An installed application requires a reboot to finish installing.") : NULL);
+        gtk_main_quit ();
+        return;
+    }
+
+    // Once everything has been applied, re-read the list so that its IDs match what is now installed - unless there
+    // are changes which have not been applied yet, as those would be lost
+    b = get_selection ();
+    idle = !b->n_inst && !b->n_uninst;
+    free_batch (b);
+    if (idle) reload (NULL, NULL);
+    else gtk_label_set_text (GTK_LABEL (size_lbl), msg);
+}
+
+static void drop_batches (void)
+{
+    // a failure stops the queue - the list is re-read once the error has been seen, which clears the queued entries
+    if (batch) free_batch (batch);
+    batch = NULL;
+    if (batches) while (!g_queue_is_empty (batches)) free_batch ((Batch *) g_queue_pop_head (batches));
+    journal_save ();
+    gtk_widget_set_visible (bg_btn, FALSE);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Background installation                                                    */
+/*----------------------------------------------------------------------------*/
+
+static void background_handler (GtkButton* btn, gpointer ptr)
+{
+    if (!batch) return;
+
+    // PackageKit only reads the priority when a transaction is created, so it applies from the next one on
+    detached = TRUE;
+    g_object_set (session, "background", TRUE, NULL);
+
+    // anything not yet applied would never be, so there is nothing left to show
+    if (est_cancel) g_cancellable_cancel (est_cancel);
+    if (det_cancel) g_cancellable_cancel (det_cancel);
+    gtk_widget_hide (main_dlg);
+}
+
+static void notify (const char *summary, const char *body)
+{
+    GDBusConnection *bus;
+    GVariant *res;
+
+    // sudo keeps the session bus address, and the bus accepts root as well as its owner
+    bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+    if (!bus) return;
+    res = g_dbus_connection_call_sync (bus, "org.freedesktop.Notifications", "/org/freedesktop/Notifications",
+        "org.freedesktop.Notifications", "Notify", g_variant_new ("(susssasa{sv}i)", _("Recommended Software"), 0, "rpi",
+        summary, body ? body : "", NULL, NULL, -1), NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (res) g_variant_unref (res);
+    g_object_unref (bus);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Transaction journal                                                        */
+/*----------------------------------------------------------------------------*/
+
+static void journal_save (void)
+{
+    GKeyFile *kf;
+    GList *l;
+    gchar *path, *data;
+    gsize len;
+    int n = 0;
+
+    path = g_build_filename (PACKAGE_STATE_DIR, JOURNAL_FILE, NULL);
+
+    // nothing left to do - a clean finish leaves no journal behind
+    if (!batch && (!batches || g_queue_is_empty (batches)))
+    {
+        g_unlink (path);
+        g_free (path);
+        return;
+    }
+
+    // the running batch comes first, followed by those waiting, so they are resumed in the same order
+    kf = g_key_file_new ();
+    if (batch) journal_batch (kf, batch, n++);
+    if (batches) for (l = batches->head; l; l = l->next) journal_batch (kf, (Batch *) l->data, n++);
+
+    // written to a new file and renamed over the old, so a crash leaves one or the other intact
+    data = g_key_file_to_data (kf, &len, NULL);
+    g_mkdir_with_parents (PACKAGE_STATE_DIR, 0755);
+    g_file_set_contents (path, data, len, NULL);
+    g_free (data);
+    g_key_file_free (kf);
+    g_free (path);
+}
+
+static void journal_batch (GKeyFile *kf, Batch *b, int n)
+{
+    gchar *group;
+
+    group = g_strdup_printf ("Batch %d", n);
+    g_key_file_set_string_list (kf, group, "install", (const gchar * const *) b->inst, b->n_inst);
+    g_key_file_set_string_list (kf, group, "remove", (const gchar * const *) b->uninst, b->n_uninst);
+    if (b->n_update) g_key_file_set_string_list (kf, group, "update", (const gchar * const *) b->update, b->n_update);
+    g_key_file_set_boolean (kf, group, "reboot", b->reboot);
+    if (b->done && b->done->len) g_key_file_set_string_list (kf, group, "done", (const gchar * const *) b->done->pdata, b->done->len);
+    g_free (group);
+}
+
+static void journal_done (const gchar *package_id)
+{
+    gchar *name;
+    int i;
+
+    // a package of the running batch has been installed, removed or updated - only the name is kept, as the
+    // version in the ID reported while installing can differ from the one asked for
+    name = g_strndup (package_id, strcspn (package_id, ";"));
+    if (!batch->done) batch->done = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < batch->done->len; i++)
+    {
+        if (!g_strcmp0 (g_ptr_array_index (batch->done, i), name))
+        {
+            g_free (name);
+            return;
+        }
+    }
+    g_ptr_array_add (batch->done, name);
+    journal_save ();
+}
+
+static void journal_resume (void)
+{
+    GKeyFile *kf;
+    gchar *path, **groups, *buf;
+    int i, count = 0;
+
+    path = g_build_filename (PACKAGE_STATE_DIR, JOURNAL_FILE, NULL);
+    kf = g_key_file_new ();
+    if (!g_key_file_load_from_file (kf, path, G_KEY_FILE_NONE, NULL))
+    {
+        g_key_file_free (kf);
+        g_free (path);
+        return;
+    }
+    g_free (path);
+
+    // rebuild what was left of each batch, leaving out packages which were finished before it stopped
+    resume = g_queue_new ();
+    groups = g_key_file_get_groups (kf, NULL);
+    for (i = 0; groups[i]; i++)
+    {
+        Batch *b = g_new0 (Batch, 1);
+        gchar **done = g_key_file_get_string_list (kf, groups[i], "done", NULL, NULL);
+
+        b->inst = journal_remaining (kf, groups[i], "install", done, &b->n_inst);
+        b->uninst = journal_remaining (kf, groups[i], "remove", done, &b->n_uninst);
+        b->update = journal_remaining (kf, groups[i], "update", done, &b->n_update);
+        b->reboot = g_key_file_get_boolean (kf, groups[i], "reboot", NULL);
+        g_strfreev (done);
+
+        count += b->n_inst + b->n_uninst + b->n_update;
+        if (b->n_inst || b->n_uninst || b->n_update) g_queue_push_tail (resume, b);
+        else free_batch (b);
+    }
+    g_strfreev (groups);
+    g_key_file_free (kf);
+
+    if (!count)
+    {
+        g_queue_free (resume);
+        resume = NULL;
+        journal_save ();
+        return;
+    }
+
+    buf = g_strdup_printf (_("Changes to applications were interrupted before they finished.\nResume the remaining packages (%d)?"), count);
+    message (buf, 2, 0);
+    g_free (buf);
+}
+
+static gchar **journal_remaining (GKeyFile *kf, const gchar *group, const gchar *key, gchar **done, guint *n)
+{
+    GHashTable *installed;
+    GPtrArray *ids;
+    BundlePkg *pkg;
+    gchar **list, *id, *name, **split;
+    gboolean inst, upd;
+    int i, j;
+
+    // a package may have finished after the journal was last written, or been dealt with by hand since, so what
+    // dpkg has installed now decides whether it still needs doing - an install is done once the package is there,
+    // a removal once it is gone, and an update once the version installed is the one it was updating to
+    installed = installed_index ();
+    inst = !g_strcmp0 (key, "install");
+    upd = !g_strcmp0 (key, "update");
+    ids = g_ptr_array_new ();
+    list = g_key_file_get_string_list (kf, group, key, NULL, NULL);
+    for (i = 0; list && list[i]; i++)
+    {
+        name = g_strndup (list[i], strcspn (list[i], ";"));
+        for (j = 0; done && done[j]; j++)
+            if (!g_strcmp0 (done[j], name)) break;
+
+        pkg = g_hash_table_lookup (installed, name);
+        if ((!done || !done[j]) && (pkg != NULL) != inst)
+        {
+            // the package lists may have been refreshed since, so use the ID of the same package found this time
+            id = upd ? current_update_id (name) : current_id (name);
+            if (!id) id = g_strdup (list[i]);
+            if (upd)
+            {
+                split = pk_package_id_split (id);
+                if (split && !g_strcmp0 (pkg->version, split[PK_PACKAGE_ID_VERSION]))
+                {
+                    g_free (id);
+                    id = NULL;
+                }
+                g_strfreev (split);
+            }
+            if (id) g_ptr_array_add (ids, id);
+        }
+        g_free (name);
+    }
+    g_strfreev (list);
+
+    *n = ids->len;
+    g_ptr_array_add (ids, NULL);
+    return (gchar **) g_ptr_array_free (ids, FALSE);
+}
+
+static gchar *current_id (const gchar *name)
+{
+    GtkTreeIter iter;
+    gboolean valid;
+    gchar *ids[3], **adds, *ret = NULL;
+    int i, j;
+
+    // look for the name amongst the package, rpackage and additional package IDs of every entry
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid && !ret)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_ID, &ids[0], PACK_RPACKAGE_ID, &ids[1], PACK_ADD_IDS, &ids[2], -1);
+        for (i = 0; i < 3 && !ret; i++)
+        {
+            adds = g_strsplit (ids[i], ",", -1);
+            for (j = 0; adds[j] && !ret; j++)
+                if (prefapps_match_pid (name, adds[j])) ret = g_strdup (adds[j]);
+            g_strfreev (adds);
+        }
+        for (i = 0; i < 3; i++) g_free (ids[i]);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    return ret;
+}
+
+static gchar *current_update_id (const gchar *name)
+{
+    GtkTreeIter iter;
+    gboolean valid;
+    gchar *upd, *ret = NULL;
+
+    // the update found for an installed entry, once the update list has been read
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid && !ret)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_UPDATE_ID, &upd, -1);
+        if (upd && prefapps_match_pid (name, upd)) ret = upd;
+        else g_free (upd);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    return ret;
+}
+
+static gboolean resume_response (GtkButton *button, gpointer data)
+{
+    gboolean yes = GPOINTER_TO_INT (data);
+    Batch *b;
+
+    if (msg_dlg)
+    {
+        gtk_widget_destroy (GTK_WIDGET (msg_dlg));
+        msg_dlg = NULL;
+    }
+
+    // queued in their original order; the package manager uses any archives which were downloaded already
+    while ((b = (Batch *) g_queue_pop_head (resume)))
+    {
+        if (yes)
+        {
+            resume_rows (b);
+            queue_batch (b);
+        }
+        else free_batch (b);
+    }
+    g_queue_free (resume);
+    resume = NULL;
+
+    // declining forgets the interrupted changes
+    if (!yes) journal_save ();
+    return FALSE;
+}
+
+static void resume_rows (Batch *b)
+{
+    GtkTreeIter iter;
+    gboolean valid, queued, found, state;
+    gchar *id, *rid, *upd;
+
+    // the entries a resumed batch changes are marked as queued, and show the state they are being changed to, just
+    // as if they had been chosen and applied again; batch_done then settles them in the usual way
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_UPDATE_ID, &upd, PACK_QUEUED, &queued, -1);
+        found = TRUE;
+        state = FALSE;
+        if (queued) found = FALSE;
+        else if (id && g_strv_contains ((const gchar * const *) b->inst, id)) state = TRUE;
+        else if ((id && g_strv_contains ((const gchar * const *) b->uninst, id)) || (rid && g_strv_contains ((const gchar * const *) b->uninst, rid))) state = FALSE;
+        else if (upd && b->n_update && g_strv_contains ((const gchar * const *) b->update, upd)) state = TRUE;
+        else found = FALSE;
+        if (found)
+        {
+            gtk_list_store_set (packages, &iter, PACK_INSTALLED, state, PACK_QUEUED, TRUE, PACK_SIZE, NULL, -1);
+            update_cell_text (&iter);
+            b->rows = g_slist_prepend (b->rows, gtk_tree_iter_copy (&iter));
+        }
+        g_free (id);
+        g_free (rid);
+        g_free (upd);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    update_button ();
+}
+
+/*----------------------------------------------------------------------------*/
+/* Handlers for combined install and remove transaction                       */
+/*----------------------------------------------------------------------------*/
+
+static char *apt_name_from_id (const gchar *id, gboolean remove)
+{
+    gchar **split;
+    char *name;
+
+    // apt takes name:arch, with a trailing - on anything which is to be removed
+    split = pk_package_id_split (id);
+    if (!split) return NULL;
+    if (!g_strcmp0 (split[PK_PACKAGE_ID_ARCH], "all") || !*split[PK_PACKAGE_ID_ARCH])
+        name = g_strdup_printf ("%s%s", split[PK_PACKAGE_ID_NAME], remove ? "-" : "");
+    else
+        name = g_strdup_printf ("%s:%s%s", split[PK_PACKAGE_ID_NAME], split[PK_PACKAGE_ID_ARCH], remove ? "-" : "");
+    g_strfreev (split);
+    return name;
+}
+
+static gboolean apt_transaction (gpointer data)
+{
+    Batch *b = (Batch *) data;
+    GError *error = NULL;
+    GPtrArray *ids;
+    TxLog *tx;
+    gchar **argv, **envp, **files, *buf;
+    int i, argc = 0, out;
+
+    message (_("Installing and removing packages - please wait..."), 0 , -1);
+
+    // [sudo -A env DEBIAN_FRONTEND=noninteractive] apt-get -y -q -o APT::Status-Fd=1 install <inst> <uninst>- NULL
+    // - normally started as root already, in which case apt is run directly
+    files = bundle ? bundle_files (b->inst) : NULL;
+    argv = g_new0 (gchar *, (files ? g_strv_length (files) : b->n_inst) + b->n_uninst + 12);
+    if (geteuid () != 0)
+    {
+        argv[argc++] = g_strdup ("sudo");
+        argv[argc++] = g_strdup ("-A");
+        argv[argc++] = g_strdup ("env");
+        argv[argc++] = g_strdup ("DEBIAN_FRONTEND=noninteractive");
+    }
+    argv[argc++] = g_strdup ("apt-get");
+    argv[argc++] = g_strdup ("-y");
+    argv[argc++] = g_strdup ("-q");
+    argv[argc++] = g_strdup ("-o");
+    argv[argc++] = g_strdup ("APT::Status-Fd=1");
+    argv[argc++] = g_strdup ("install");
+    if (files)
+    {
+        // apt takes a path to a .deb in place of a package name
+        for (i = 0; files[i]; i++) argv[argc++] = g_strdup (files[i]);
+        g_strfreev (files);
+    }
+    else for (i = 0; i < b->n_inst; i++)
+        if ((buf = apt_name_from_id (b->inst[i], FALSE))) argv[argc++] = buf;
+    for (i = 0; i < b->n_uninst; i++)
+        if ((buf = apt_name_from_id (b->uninst[i], TRUE))) argv[argc++] = buf;
+    argv[argc] = NULL;
+
+    envp = g_get_environ ();
+    envp = g_environ_setenv (envp, "DEBIAN_FRONTEND", "noninteractive", TRUE);
+    if (geteuid () != 0) envp = g_environ_setenv (envp, "SUDO_ASKPASS", ASKPASS_HELPER, TRUE);
+
+    g_free (apt_error);
+    apt_error = NULL;
+
+    // one log record covers both the installs and the removals
+    ids = g_ptr_array_new ();
+    for (i = 0; i < b->n_inst; i++) g_ptr_array_add (ids, b->inst[i]);
+    for (i = 0; i < b->n_uninst; i++) g_ptr_array_add (ids, b->uninst[i]);
+    g_ptr_array_add (ids, NULL);
+    tx = tx_begin ("install", "apt", (gchar **) ids->pdata);
+    g_ptr_array_free (ids, TRUE);
+
+    if (!g_spawn_async_with_pipes (NULL, argv, envp, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDERR_TO_DEV_NULL,
+        NULL, NULL, &apt_pid, NULL, &out, NULL, &error))
+    {
+        tx_write (tx, "failed", NULL, error->message, -1);
+        buf = g_strdup_printf (_("Error %s - %s"), _("installing packages"), error->message);
+        error_box (buf, FALSE);
+        g_free (buf);
+        g_error_free (error);
+        drop_batches ();
+    }
+    else
+    {
+        apt_out = g_io_channel_unix_new (out);
+        g_io_channel_set_close_on_unref (apt_out, TRUE);
+        apt_watch = g_io_add_watch (apt_out, G_IO_IN | G_IO_HUP | G_IO_ERR, apt_status, tx);
+        g_child_watch_add (apt_pid, apt_done, tx);
+        start_stage (STAGE_INSTALL, apt_transaction, data);
+    }
+
+    g_strfreev (envp);
+    g_strfreev (argv);
+    return FALSE;
+}
+
+static gboolean apt_status (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    gchar *line, **fields, *buf;
+
+    // status lines are of the form type:package:percent:description
+    progress_time = g_get_monotonic_time () / G_USEC_PER_SEC;
+    if (condition & G_IO_IN)
+    {
+        if (g_io_channel_read_line (source, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+        {
+            g_strdelimit (line, "\n\r", 0);
+            fields = g_strsplit (line, ":", 4);
+            if (g_strv_length (fields) == 4)
+            {
+                if (!g_strcmp0 (fields[0], "dlstatus"))
+                {
+                    tx_step ((TxLog *) data, PK_STATUS_ENUM_DOWNLOAD, "download", fields[1]);
+                    message (_("Downloading packages - please wait..."), 0, (int) g_ascii_strtod (fields[2], NULL));
+                }
+                else if (!g_strcmp0 (fields[0], "pmstatus"))
+                {
+                    tx_step ((TxLog *) data, PK_STATUS_ENUM_INSTALL, "install", fields[1]);
+
+                    // dpkg is running - interrupting it now would leave packages half-configured
+                    can_cancel = FALSE;
+                    buf = g_strdup_printf (_("%s - please wait..."), fields[3]);
+                    message (buf, 0, (int) g_ascii_strtod (fields[2], NULL));
+                    g_free (buf);
+                }
+                else if (!g_strcmp0 (fields[0], "pmerror"))
+                {
+                    g_free (apt_error);
+                    apt_error = g_strdup (fields[3]);
+                }
+            }
+            g_strfreev (fields);
+            g_free (line);
+            return TRUE;
+        }
+    }
+    apt_watch = 0;
+    return FALSE;
+}
+
+static void apt_done (GPid pid, gint status, gpointer data)
+{
+    GError *error = NULL;
+    gchar *buf;
+
+    // pick up any status lines still sitting in the pipe - without blocking, as a daemon started by a package
+    // script may have inherited the write end and be holding it open
+    if (apt_watch) g_source_remove (apt_watch);
+    g_io_channel_set_flags (apt_out, G_IO_FLAG_NONBLOCK, NULL);
+    while (apt_status (apt_out, G_IO_IN, data));
+    g_io_channel_shutdown (apt_out, FALSE, NULL);
+    g_io_channel_unref (apt_out);
+    apt_out = NULL;
+    g_spawn_close_pid (pid);
+    apt_pid = 0;
+    stage_active = FALSE;
+
+    if (g_cancellable_is_cancelled (cancellable))
+    {
+        tx_write ((TxLog *) data, "cancelled", NULL, NULL, WIFEXITED (status) ? WEXITSTATUS (status) : -1);
+        cancelled (FALSE);
+        if (!retry_id) drop_batches ();
+        return;
+    }
+
+    if (!g_spawn_check_exit_status (status, &error))
+    {
+        tx_write ((TxLog *) data, "failed", NULL, apt_error ? apt_error : error->message, WIFEXITED (status) ? WEXITSTATUS (status) : -1);
+        buf = g_strdup_printf (_("Error %s - %s"), _("installing packages"), apt_error ? apt_error : error->message);
+        error_box (buf, FALSE);
+        g_free (buf);
+        g_error_free (error);
+        drop_batches ();
+        return;
+    }
+
+    tx_write ((TxLog *) data, "success", NULL, NULL, 0);
+    batch_done (_("Installation and removal complete"));
+}
+
+/*----------------------------------------------------------------------------*/
+/* Updates available for installed entries                                    */
+/*----------------------------------------------------------------------------*/
+
+static void check_updates (void)
+{
+    gchar **ids;
+    TxLog *tx;
+
+    // nothing can be fetched from a bundle
+    if (bundle) return;
+
+    // the saved list stands until the package lists or the installed packages change
+    if ((ids = prefapps_updates_load ()))
+    {
+        apply_updates (ids);
+        g_strfreev (ids);
+        return;
+    }
+
+    tx = tx_begin ("get-updates", "packagekit", NULL);
+    pk_client_get_updates_async (PK_CLIENT (session), 0, NULL, (PkProgressCallback) tx_progress, tx, (GAsyncReadyCallback) updates_done, tx);
+}
+
+static void updates_done (PkClient *client, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+    PkPackage *item;
+    GPtrArray *array, *ids;
+    GHashTable *names;
+    GError *error = NULL;
+    GtkTreeIter iter;
+    gboolean valid, init;
+    gchar *id, *rid;
+    int i;
+
+    // updates are only a convenience - if they can't be found, the entries just show no updates
+    results = pk_client_generic_finish (client, res, &error);
+    tx_finish ((TxLog *) data, results, error);
+    if (error) g_error_free (error);
+    if (!results || pk_results_get_error_code (results))
+    {
+        if (results) g_object_unref (results);
+        return;
+    }
+
+    // only keep updates to packages of installed entries
+    names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INIT_INST, &init, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, -1);
+        if (init && g_strcmp0 (id, "none")) g_hash_table_add (names, g_strndup (id, strcspn (id, ";")));
+        if (init && g_strcmp0 (rid, "none")) g_hash_table_add (names, g_strndup (rid, strcspn (rid, ";")));
+        g_free (id);
+        g_free (rid);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+
+    ids = g_ptr_array_new ();
+    array = pk_results_get_package_array (results);
+    for (i = 0; i < array->len; i++)
+    {
+        item = g_ptr_array_index (array, i);
+        if (g_hash_table_contains (names, pk_package_get_name (item))) g_ptr_array_add (ids, (gpointer) pk_package_get_id (item));
+    }
+    g_ptr_array_add (ids, NULL);
+
+    prefapps_updates_save ((gchar **) ids->pdata);
+    apply_updates ((gchar **) ids->pdata);
+
+    g_ptr_array_free (ids, TRUE);
+    g_ptr_array_unref (array);
+    g_hash_table_destroy (names);
+    g_object_unref (results);
+}
+
+static void apply_updates (gchar **ids)
+{
+    GHashTable *updates;
+    GtkTreeIter iter;
+    gboolean valid, init;
+    gchar *id, *rid, *name, *upd;
+    int i;
+
+    updates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; ids[i]; i++) g_hash_table_insert (updates, g_strndup (ids[i], strcspn (ids[i], ";")), ids[i]);
+
+    // an installed entry has an update if either its package or its rpackage does
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INIT_INST, &init, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, -1);
+        upd = NULL;
+        if (init && g_strcmp0 (id, "none"))
+        {
+            name = g_strndup (id, strcspn (id, ";"));
+            upd = g_hash_table_lookup (updates, name);
+            g_free (name);
+        }
+        if (init && !upd && g_strcmp0 (rid, "none"))
+        {
+            name = g_strndup (rid, strcspn (rid, ";"));
+            upd = g_hash_table_lookup (updates, name);
+            g_free (name);
+        }
+        gtk_list_store_set (packages, &iter, PACK_UPDATE_ID, upd ? upd : "none", -1);
+        update_cell_text (&iter);
+        g_free (id);
+        g_free (rid);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    g_hash_table_destroy (updates);
+
+    update_button ();
+}
+
+static void update_button (void)
+{
+    GtkTreeIter iter;
+    gboolean valid, init, state, queued;
+    gchar *upd, *buf;
+    int count = 0;
+
+    // count the entries which could be updated now
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INIT_INST, &init, PACK_INSTALLED, &state, PACK_QUEUED, &queued, PACK_UPDATE_ID, &upd, -1);
+        if (init && state && !queued && g_strcmp0 (upd, "none")) count++;
+        g_free (upd);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+
+    if (count)
+    {
+        buf = g_strdup_printf (_("_Update All (%d)"), count);
+        gtk_button_set_label (GTK_BUTTON (update_btn), buf);
+        g_free (buf);
+    }
+    gtk_widget_set_visible (update_btn, count != 0);
+}
+
+static void update_handler (GtkButton* btn, gpointer ptr)
+{
+    GtkTreeIter iter;
+    GPtrArray *ids;
+    Batch *b;
+    gboolean valid, init, state, queued;
+    gchar *upd;
+
+    // every installed entry with an update, other than those already waiting in a batch, goes in one transaction
+    b = g_new0 (Batch, 1);
+    ids = g_ptr_array_new ();
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INIT_INST, &init, PACK_INSTALLED, &state, PACK_QUEUED, &queued, PACK_UPDATE_ID, &upd, -1);
+        if (init && state && !queued && g_strcmp0 (upd, "none"))
+        {
+            g_ptr_array_add (ids, upd);
+            gtk_list_store_set (packages, &iter, PACK_QUEUED, TRUE, -1);
+            update_cell_text (&iter);
+            b->rows = g_slist_prepend (b->rows, gtk_tree_iter_copy (&iter));
+        }
+        else g_free (upd);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+    b->n_update = ids->len;
+    g_ptr_array_add (ids, NULL);
+    b->update = (gchar **) g_ptr_array_free (ids, FALSE);
+    update_button ();
+
+    if (!b->n_update)
+    {
+        free_batch (b);
+        return;
+    }
+
+    queue_batch (b);
+}
+
+static gboolean start_update (gpointer data)
+{
+    Batch *b = (Batch *) data;
+    TxLog *tx;
+
+    message (_("Updating applications - please wait..."), 0 , -1);
+
+    start_stage (STAGE_INSTALL, start_update, data);
+    tx = tx_begin ("update", "packagekit", b->update);
+    pk_task_update_packages_async (b->task, b->update, cancellable, (PkProgressCallback) progress, tx, (GAsyncReadyCallback) update_all_done, tx);
+    return FALSE;
+}
+
+static void update_all_done (PkTask *task, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+
+    results = error_handler (task, res, (TxLog *) data, _("updating applications"), FALSE, FALSE);
+    if (!results)
+    {
+        if (!retry_id) drop_batches ();
+        return;
+    }
+    g_object_unref (results);
+
+    batch_done (_("Update complete"));
+}
+
+/*----------------------------------------------------------------------------*/
+/* Download and disk space estimate for the current selection                 */
+/*----------------------------------------------------------------------------*/
+
+static void schedule_estimate (void)
+{
+    // wait for the toggles to settle before working anything out
+    if (est_timer) g_source_remove (est_timer);
+    if (est_cancel) g_cancellable_cancel (est_cancel);
+
+    est_short = FALSE;
+    gtk_widget_set_sensitive (apply_btn, TRUE);
+    gtk_label_set_text (GTK_LABEL (size_lbl), "");
+
+    est_timer = g_timeout_add (750, start_estimate, NULL);
+}
+
+static gboolean start_estimate (gpointer data)
+{
+    SizeEstimate *est;
+    Batch *sel;
+
+    est_timer = 0;
+    if (est_cancel) g_object_unref (est_cancel);
+    est_cancel = g_cancellable_new ();
+
+    sel = get_selection ();
+    if (!sel->n_inst && !sel->n_uninst)
+    {
+        free_batch (sel);
+        return FALSE;
+    }
+
+    gtk_label_set_text (GTK_LABEL (size_lbl), _("Calculating space required..."));
+
+    est = g_new0 (SizeEstimate, 1);
+    est->sel = sel;
+    est->inst = g_ptr_array_new_with_free_func (g_free);
+    est->uninst = g_ptr_array_new_with_free_func (g_free);
+    est->upgrade = g_ptr_array_new_with_free_func (g_free);
+    est->cancel = g_object_ref (est_cancel);
+
+    // simulate the transaction so that the backend does the dependency solve
+    if (sel->n_inst && bundle)
+    {
+        gchar **files = bundle_files (sel->inst);
+        pk_client_install_files_async (PK_CLIENT (session), pk_bitfield_value (PK_TRANSACTION_FLAG_ENUM_SIMULATE), files, est_cancel,
+            NULL, NULL, (GAsyncReadyCallback) est_install_done, est);
+        g_strfreev (files);
+    }
+    else if (sel->n_inst)
+        pk_client_install_packages_async (PK_CLIENT (session), pk_bitfield_value (PK_TRANSACTION_FLAG_ENUM_SIMULATE), sel->inst, est_cancel,
+            NULL, NULL, (GAsyncReadyCallback) est_install_done, est);
+    else
+        pk_client_remove_packages_async (PK_CLIENT (session), pk_bitfield_value (PK_TRANSACTION_FLAG_ENUM_SIMULATE), sel->uninst, TRUE, TRUE, est_cancel,
+            NULL, NULL, (GAsyncReadyCallback) est_remove_done, est);
+    return FALSE;
+}
+
+static void est_collect (PkResults *results, SizeEstimate *est)
+{
+    PkPackage *item;
+    GPtrArray *array;
+    int i;
+
+    array = pk_results_get_package_array (results);
+    for (i = 0; i < array->len; i++)
+    {
+        item = g_ptr_array_index (array, i);
+        switch (pk_package_get_info (item))
+        {
+            case PK_INFO_ENUM_UPDATING :
+            case PK_INFO_ENUM_REINSTALLING :
+            case PK_INFO_ENUM_DOWNGRADING : g_ptr_array_add (est->upgrade, apt_name_from_id (pk_package_get_id (item), FALSE));
+                                            // fall through - the new version is counted like any other install
+            case PK_INFO_ENUM_INSTALLING :  g_ptr_array_add (est->inst, apt_name_from_id (pk_package_get_id (item), FALSE));
+                                            break;
+
+            case PK_INFO_ENUM_REMOVING :
+            case PK_INFO_ENUM_OBSOLETING :  g_ptr_array_add (est->uninst, apt_name_from_id (pk_package_get_id (item), FALSE));
+                                            break;
+
+            default :                       break;
+        }
+    }
+    g_ptr_array_unref (array);
+}
+
+static void est_install_done (PkClient *client, GAsyncResult *res, gpointer data)
+{
+    SizeEstimate *est = (SizeEstimate *) data;
+    PkResults *results;
+
+    results = pk_client_generic_finish (client, res, NULL);
+    if (!results || g_cancellable_is_cancelled (est->cancel))
+    {
+        // no estimate is better than a wrong one - the transaction itself will report any problem
+        if (results) g_object_unref (results);
+        if (!g_cancellable_is_cancelled (est->cancel)) gtk_label_set_text (GTK_LABEL (size_lbl), "");
+        est_free (est);
+        return;
+    }
+    est_collect (results, est);
+    g_object_unref (results);
+
+    if (est->sel->n_uninst)
+        pk_client_remove_packages_async (PK_CLIENT (session), pk_bitfield_value (PK_TRANSACTION_FLAG_ENUM_SIMULATE), est->sel->uninst, TRUE, TRUE, est->cancel,
+            NULL, NULL, (GAsyncReadyCallback) est_remove_done, est);
+    else est_start_sizes (est);
+}
+
+static void est_remove_done (PkClient *client, GAsyncResult *res, gpointer data)
+{
+    SizeEstimate *est = (SizeEstimate *) data;
+    PkResults *results;
+
+    results = pk_client_generic_finish (client, res, NULL);
+    if (!results || g_cancellable_is_cancelled (est->cancel))
+    {
+        if (results) g_object_unref (results);
+        if (!g_cancellable_is_cancelled (est->cancel)) gtk_label_set_text (GTK_LABEL (size_lbl), "");
+        est_free (est);
+        return;
+    }
+    est_collect (results, est);
+    g_object_unref (results);
+
+    est_start_sizes (est);
+}
+
+static void est_start_sizes (SizeEstimate *est)
+{
+    GTask *gt;
+
+    // reading the sizes means running apt-cache and dpkg-query, so keep it off the main loop
+    gt = g_task_new (NULL, est->cancel, est_done, NULL);
+    g_task_set_task_data (gt, est, est_free);
+    g_task_run_in_thread (gt, est_read_sizes);
+    g_object_unref (gt);
+}
+
+static void est_read_sizes (GTask *gt, gpointer source, gpointer data, GCancellable *cancel)
+{
+    SizeEstimate *est = (SizeEstimate *) data;
+    struct statvfs fs;
+    gchar **argv, **lines, *out, *name, *arch, *key;
+    guint64 size, isize, *dsize;
+    int i, argc;
+
+    est->sizes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    // candidate versions of the packages to be installed - Size is in bytes, Installed-Size in KiB
+    if (est->inst->len)
+    {
+        argv = g_new0 (gchar *, est->inst->len + 4);
+        argc = 0;
+        argv[argc++] = "apt-cache";
+        argv[argc++] = "show";
+        argv[argc++] = "--no-all-versions";
+        for (i = 0; i < est->inst->len; i++) argv[argc++] = g_ptr_array_index (est->inst, i);
+
+        if (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, NULL, NULL))
+        {
+            name = arch = NULL;
+            size = isize = 0;
+            lines = g_strsplit (out, "\n", -1);
+            for (i = 0; lines[i]; i++)
+            {
+                if (!strncmp (lines[i], "Package: ", 9)) name = lines[i] + 9;
+                else if (!strncmp (lines[i], "Architecture: ", 14)) arch = lines[i] + 14;
+                else if (!strncmp (lines[i], "Size: ", 6)) size = g_ascii_strtoull (lines[i] + 6, NULL, 10);
+                else if (!strncmp (lines[i], "Installed-Size: ", 16)) isize = g_ascii_strtoull (lines[i] + 16, NULL, 10) * 1024;
+                else if (!*lines[i] && name)
+                {
+                    // blank line ends each stanza; key by the same name:arch form as apt_name_from_id
+                    if (!arch || !g_strcmp0 (arch, "all")) key = g_strdup (name);
+                    else key = g_strdup_printf ("%s:%s", name, arch);
+                    dsize = g_new (guint64, 1);
+                    *dsize = size;
+                    g_hash_table_replace (est->sizes, key, dsize);
+                    est->download += size;
+                    est->installed += isize;
+                    name = arch = NULL;
+                    size = isize = 0;
+                }
+            }
+            g_strfreev (lines);
+            g_free (out);
+        }
+        g_free (argv);
+    }
+
+    // installed versions of the packages to be upgraded - only the difference in size is taken up or given back
+    if (est->upgrade->len)
+    {
+        argv = g_new0 (gchar *, est->upgrade->len + 4);
+        argc = 0;
+        argv[argc++] = "dpkg-query";
+        argv[argc++] = "-W";
+        argv[argc++] = "-f=${Installed-Size}\\n";
+        for (i = 0; i < est->upgrade->len; i++) argv[argc++] = g_ptr_array_index (est->upgrade, i);
+
+        if (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, NULL, NULL))
+        {
+            size = 0;
+            lines = g_strsplit (out, "\n", -1);
+            for (i = 0; lines[i]; i++) size += g_ascii_strtoull (lines[i], NULL, 10) * 1024;
+            if (est->installed >= size) est->installed -= size;
+            else
+            {
+                est->freed += size - est->installed;
+                est->installed = 0;
+            }
+            g_strfreev (lines);
+            g_free (out);
+        }
+        g_free (argv);
+    }
+
+    // installed versions of the packages to be removed
+    if (est->uninst->len)
+    {
+        argv = g_new0 (gchar *, est->uninst->len + 4);
+        argc = 0;
+        argv[argc++] = "dpkg-query";
+        argv[argc++] = "-W";
+        argv[argc++] = "-f=${Installed-Size}\\n";
+        for (i = 0; i < est->uninst->len; i++) argv[argc++] = g_ptr_array_index (est->uninst, i);
+
+        if (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, &out, NULL, NULL, NULL))
+        {
+            lines = g_strsplit (out, "\n", -1);
+            for (i = 0; lines[i]; i++) est->freed += g_ascii_strtoull (lines[i], NULL, 10) * 1024;
+            g_strfreev (lines);
+            g_free (out);
+        }
+        g_free (argv);
+    }
+
+    if (statvfs ("/", &fs) == 0) est->avail = (guint64) fs.f_bavail * fs.f_frsize;
+
+    g_task_return_boolean (gt, TRUE);
+}
+
+static void est_done (GObject *source, GAsyncResult *res, gpointer data)
+{
+    SizeEstimate *est;
+    GtkTreeIter iter;
+    gboolean valid, state, init;
+    gchar *id, *addid, *add, *key, *dl, *disk, *avail, *buf;
+    guint64 size, needed, *dsize;
+
+    if (!g_task_propagate_boolean (G_TASK (res), NULL)) return;
+    est = g_task_get_task_data (G_TASK (res));
+
+    // archives are fetched before anything is removed, so freed space can't be counted on
+    needed = est->download + est->installed;
+    est_short = est->avail && needed > est->avail;
+
+    dl = g_format_size (est->download);
+    avail = g_format_size (est->avail);
+    if (est_short)
+    {
+        disk = g_format_size (needed);
+        buf = g_strdup_printf (_("<span foreground=\"red\">Not enough disk space - %s needed, %s free</span>"), disk, avail);
+    }
+    else if (est->installed >= est->freed)
+    {
+        disk = g_format_size (est->installed - est->freed);
+        buf = g_strdup_printf (_("Download %s, uses %s of %s free"), dl, disk, avail);
+    }
+    else
+    {
+        disk = g_format_size (est->freed - est->installed);
+        buf = g_strdup_printf (_("Download %s, frees %s"), dl, disk);
+    }
+    gtk_label_set_markup (GTK_LABEL (size_lbl), buf);
+    gtk_widget_set_sensitive (apply_btn, !est_short);
+    g_free (buf);
+    g_free (disk);
+    g_free (avail);
+    g_free (dl);
+
+    // fill in the download size of each entry which is to be installed
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &iter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &iter, PACK_INSTALLED, &state, PACK_INIT_INST, &init, PACK_PACKAGE_ID, &id, PACK_ADD_IDS, &addid, -1);
+        if (state && !init)
+        {
+            key = apt_name_from_id (id, FALSE);
+            dsize = key ? g_hash_table_lookup (est->sizes, key) : NULL;
+            size = dsize ? *dsize : 0;
+            g_free (key);
+            if (g_strcmp0 (addid, "none"))
+            {
+                add = strtok (addid, ",");
+                while (add)
+                {
+                    key = apt_name_from_id (add, FALSE);
+                    if (key && (dsize = g_hash_table_lookup (est->sizes, key))) size += *dsize;
+                    g_free (key);
+                    add = strtok (NULL, ",");
+                }
+            }
+            buf = size ? g_format_size (size) : NULL;
+            gtk_list_store_set (packages, &iter, PACK_SIZE, buf, -1);
+            update_cell_text (&iter);
+            g_free (buf);
+        }
+        g_free (id);
+        g_free (addid);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &iter);
+    }
+}
+
+static void est_free (gpointer data)
+{
+    SizeEstimate *est = (SizeEstimate *) data;
+
+    free_batch (est->sel);
+    g_ptr_array_unref (est->inst);
+    g_ptr_array_unref (est->uninst);
+    g_ptr_array_unref (est->upgrade);
+    if (est->sizes) g_hash_table_destroy (est->sizes);
+    g_object_unref (est->cancel);
+    g_free (est);
+}
+
+static gboolean clock_synced (void)
+{
+    if (system ("test -e /usr/sbin/ntpd") == 0)
+    {
+        if (system ("ntpq -p | grep -q ^\\*") == 0) return TRUE;
+    }
+    else
+    {
+        if (system ("timedatectl status | grep -q \"synchronized: yes\"") == 0) return TRUE;
+    }
+    return FALSE;
+}
+
+static void resync (void)
+{
+    if (system ("test -e /usr/sbin/ntpd") == 0)
+    {
+        system ("/etc/init.d/ntp stop; ntpd -gq; /etc/init.d/ntp start");
+    }
+    else
+    {
+        system ("systemctl -q stop systemd-timesyncd 2> /dev/null; systemctl -q start systemd-timesyncd 2> /dev/null");
+    }
+}
+
+static gboolean ntp_check (gpointer data)
+{
+    if (g_cancellable_is_cancelled (cancellable))
+    {
+        quit (NULL, (void *) 0);
+        return FALSE;
+    }
+
+    gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
+    if (clock_synced ())
+    {
+        g_idle_add (update_self, NULL);
+        return FALSE;
+    }
+    // trigger a resync
+    if (calls == 0) resync ();
+
+    if (calls++ > 120)
+    {
+        error_box (_("Error synchronising clock - could not sync with time server"), TRUE);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static char *get_shell_string (char *cmd)
+{
+    char *line = NULL, *res = NULL;
+    size_t len = 0;
+    FILE *fp = popen (cmd, "r");
+
+    if (fp == NULL) return g_strdup ("");
+    if (getline (&line, &len, fp) > 0)
+    {
+        g_strdelimit (line, "\n\r", 0);
+        res = line;
+        while (*res++) if (g_ascii_isspace (*res)) *res = 0;
+        res = g_strdup (line);
+    }
+    pclose (fp);
+    g_free (line);
+    return res ? res : g_strdup ("");
+}
+
+static gboolean net_available (void)
+{
+    char *ip;
+    gboolean val = FALSE;
+
+    ip = get_shell_string ("hostname -I | tr ' ' \\\\n | grep \\\\. | tr \\\\n ','");
+    if (ip)
+    {
+        if (strlen (ip)) val = TRUE;
+        g_free (ip);
+    }
+    return val;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Helper functions for tree views                                            */
+/*----------------------------------------------------------------------------*/
+
+static const char *cat_icon_name (char *category)
+{
+    if (!g_strcmp0 (category, N_("Programming")))
+        return "applications-development";
+
+    if (!g_strcmp0 (category, N_("Office")))
+        return "applications-office";
+
+    if (!g_strcmp0 (category, N_("Internet")))
+        return "applications-internet";
+
+    if (!g_strcmp0 (category, N_("Games")))
+        return "applications-games";
+
+    if (!g_strcmp0 (category, N_("Other")))
+        return "applications-other";
+
+    if (!g_strcmp0 (category, N_("Accessories")))
+        return "applications-accessories";
+
+    if (!g_strcmp0 (category, N_("Sound & Video")))
+        return "applications-multimedia";
+
+    if (!g_strcmp0 (category, N_("System Tools")))
+        return "applications-system";
+
+    if (!g_strcmp0 (category, N_("Engineering")))
+        return "applications-engineering";
+
+    if (!g_strcmp0 (category, N_("Education")))
+        return "applications-science";
+
+    if (!g_strcmp0 (category, N_("Graphics")))
+        return "applications-graphics";
+
+    if (!g_strcmp0 (category, N_("Science & Maths")))
+        return "applications-science";
+
+    if (!g_strcmp0 (category, N_("Preferences")))
+        return "preferences-desktop";
+
+    if (!g_strcmp0 (category, N_("Universal Access")))
+        return "preferences-desktop-accessibility";
+
+    return NULL;
+}
+
+static gboolean match_category (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+    GtkTreeModel *cmodel;
+    GtkTreeIter citer;
+    GtkTreeSelection *sel;
+    char *id, *rid, *pcat, *desc, *cat;
+    const gchar *search;
+    gboolean res;
+
+    // get the current category selection from the category box
+    sel = gtk_tree_view_get_selection (GTK_TREE_VIEW (cat_tv));
+    if (sel && gtk_tree_selection_get_selected (sel, &cmodel, &citer))
+    {
+        gtk_tree_model_get (cmodel, &citer, CAT_NAME, &cat, -1);
+    }
+    else cat = g_strdup ("All Programs");
+
+    // first make sure the package has a package ID - ignore if not
+    gtk_tree_model_get (model, iter, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_CATEGORY, &pcat, PACK_CELL_DESC, &desc, -1);
+    if (!g_strcmp0 (id, "none") && !g_strcmp0 (rid, "none")) res = FALSE;
+    else
+    {
+        // check that category matches
+        if (!g_strcmp0 (cat, "All Programs")) res = TRUE;
+        else
+        {
+            if (!g_strcmp0 (cat, pcat)) res = TRUE;
+            else res = FALSE;
+        }
+
+        // filter on search text
+        if (res)
+        {
+            search = gtk_entry_get_text (GTK_ENTRY (search_te));
+            if (search[0])
+            {
+                if (!strcasestr (desc, search)) res = FALSE;
+            }
+        }
+    }
+    g_free (id);
+    g_free (rid);
+    g_free (desc);
+    g_free (cat);
+    return res;
+}
+
+static gboolean packs_in_cat (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+    GtkTreeIter piter;
+    gboolean valid;
+    gchar *pcat, *tcat, *id, *rid;
+
+	// get the category under test
+    gtk_tree_model_get (model, iter, CAT_NAME, &tcat, -1);
+
+    // always show All Programs category
+    if (!g_strcmp0 (tcat, "All Programs")) return TRUE;
+
+	// loop through all packages in database - show category only if it matches a program with a valid ID
+    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &piter);
+    while (valid)
+    {
+        gtk_tree_model_get (GTK_TREE_MODEL (packages), &piter, PACK_CATEGORY, &pcat, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, -1);
+        if (!g_strcmp0 (pcat, tcat) && (g_strcmp0 (id, "none") || g_strcmp0 (rid, "none")))
+        {
+			g_free (tcat);
+			g_free (id);
+			g_free (rid);
+			return TRUE;
+		}
+
+		g_free (id);
+		g_free (rid);
+        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &piter);
+    }
+    g_free (tcat);
+    return FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Offline package bundle                                                     */
+/*----------------------------------------------------------------------------*/
+
+static gboolean load_bundle (const gchar *dir)
+{
+    gchar *path, *arch;
+
+    // packages which can't be installed on this machine are left out, so there is at most one per name
+    path = g_build_filename (dir, BUNDLE_INDEX, NULL);
+    arch = get_shell_string ("dpkg --print-architecture");
+    bundle = read_index (path, arch, FALSE);
+    g_free (arch);
+    g_free (path);
+    if (!bundle) return FALSE;
+
+    bundle_dir = g_strdup (dir);
+    return TRUE;
+}
+
+static GHashTable *read_index (const gchar *path, const gchar *arch, gboolean installed)
+{
+    GHashTable *index;
+    BundlePkg *pkg = NULL;
+    GString *desc = NULL;
+    gchar *contents, **lines, *val, *line;
+    gboolean ok = FALSE;
+    int i;
+
+    // reads a Packages index, or with installed set, the dpkg status file - both are stanzas of Key: value lines,
+    // separated by blank lines, with continuation lines starting with a space
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) return NULL;
+    index = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, free_bundle_pkg);
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    // the end of the file is treated as one more blank line, to finish the last stanza
+    for (i = 0; ; i++)
+    {
+        line = lines[i] ? lines[i] : "";
+        if (!pkg) pkg = g_new0 (BundlePkg, 1);
+
+        if (*line == ' ' || *line == '\t')
+        {
+            // only the description runs on, and a lone . stands for a blank line
+            if (desc)
+            {
+                if (desc->len) g_string_append_c (desc, '\n');
+                if (g_strcmp0 (g_strstrip (line), ".")) g_string_append (desc, line);
+            }
+            continue;
+        }
+        if (desc)
+        {
+            pkg->description = g_string_free (desc, FALSE);
+            desc = NULL;
+        }
+
+        if (*line)
+        {
+            val = strchr (line, ':');
+            if (!val) continue;
+            *val++ = 0;
+            g_strstrip (val);
+            if (!g_ascii_strcasecmp (line, "Package")) pkg->name = g_strdup (val);
+            else if (!g_ascii_strcasecmp (line, "Version")) pkg->version = g_strdup (val);
+            else if (!g_ascii_strcasecmp (line, "Architecture")) pkg->arch = g_strdup (val);
+            else if (!g_ascii_strcasecmp (line, "Filename")) pkg->file = g_strdup (val);
+            else if (!g_ascii_strcasecmp (line, "Status")) ok = g_str_has_suffix (val, " installed");
+            else if (!g_ascii_strcasecmp (line, "Depends") || !g_ascii_strcasecmp (line, "Pre-Depends"))
+            {
+                val = g_strdup_printf ("%s%s%s", pkg->depends ? pkg->depends : "", pkg->depends ? ", " : "", val);
+                g_free (pkg->depends);
+                pkg->depends = val;
+            }
+            else if (!g_ascii_strcasecmp (line, "Description"))
+            {
+                pkg->summary = g_strdup (val);
+                desc = g_string_new (NULL);
+            }
+            continue;
+        }
+
+        // end of a stanza - keep an installed package, or a bundle package which can be installed here
+        if (pkg->name && (installed ? ok : (pkg->version && pkg->file && (!g_strcmp0 (pkg->arch, "all") || !g_strcmp0 (pkg->arch, arch)))))
+            g_hash_table_replace (index, pkg->name, pkg);
+        else free_bundle_pkg (pkg);
+        pkg = NULL;
+        ok = FALSE;
+        if (!lines[i]) break;
+    }
+
+    g_strfreev (lines);
+    return index;
+}
+
+static void free_bundle_pkg (gpointer data)
+{
+    BundlePkg *pkg = (BundlePkg *) data;
+
+    g_free (pkg->name);
+    g_free (pkg->version);
+    g_free (pkg->arch);
+    g_free (pkg->file);
+    g_free (pkg->summary);
+    g_free (pkg->description);
+    g_free (pkg->depends);
+    g_free (pkg);
+}
+
+static void bundle_resolve (gchar **names)
+{
+    PkPackage *item;
+    BundlePkg *pkg;
+    gchar *id;
+    int i;
+
+    // every catalog name found in the bundle is offered from it, under a package ID marked as coming from there
+    for (i = 0; names[i]; i++)
+    {
+        pkg = g_hash_table_lookup (bundle, names[i]);
+        if (!pkg) continue;
+
+        id = pk_package_id_build (pkg->name, pkg->version, pkg->arch, BUNDLE_DATA);
+        item = pk_package_new ();
+        if (pk_package_set_id (item, id, NULL))
+        {
+            g_object_set (item, "info", PK_INFO_ENUM_AVAILABLE, "summary", pkg->summary, NULL);
+            queue_package (item);
+        }
+        g_object_unref (item);
+        g_free (id);
+    }
+}
+
+static BundlePkg *bundle_lookup (const gchar *id)
+{
+    BundlePkg *pkg = NULL;
+    gchar **split;
+
+    if (!bundle || !id) return NULL;
+    split = pk_package_id_split (id);
+    if (!split) return NULL;
+    if (!g_strcmp0 (split[PK_PACKAGE_ID_DATA], BUNDLE_DATA))
+    {
+        pkg = g_hash_table_lookup (bundle, split[PK_PACKAGE_ID_NAME]);
+        if (pkg && g_strcmp0 (pkg->version, split[PK_PACKAGE_ID_VERSION])) pkg = NULL;
+    }
+    g_strfreev (split);
+    return pkg;
+}
+
+static GHashTable *installed_index (void)
+{
+    GStatBuf st;
+
+    // the status file runs to megabytes, so it is only read again once dpkg has changed it, not for every estimate
+    if (g_stat (DPKG_STATUS_FILE, &st)) st.st_mtime = st.st_size = 0;
+    if (!bundle_installed || st.st_mtime != bundle_status_time || st.st_size != bundle_status_size)
+    {
+        if (bundle_installed) g_hash_table_destroy (bundle_installed);
+        bundle_installed = read_index (DPKG_STATUS_FILE, NULL, TRUE);
+        if (!bundle_installed) bundle_installed = g_hash_table_new (g_str_hash, g_str_equal);
+        bundle_status_time = st.st_mtime;
+        bundle_status_size = st.st_size;
+    }
+    return bundle_installed;
+}
+
+static gchar **bundle_files (gchar **ids)
+{
+    GHashTable *installed, *seen;
+    GPtrArray *files;
+    BundlePkg *pkg;
+    int i;
+
+    // the files for the given packages, plus any of their dependencies in the bundle which are not yet installed
+    installed = installed_index ();
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+    files = g_ptr_array_new ();
+
+    for (i = 0; ids[i]; i++)
+        if ((pkg = bundle_lookup (ids[i]))) bundle_deps (pkg, installed, seen, files);
+    g_ptr_array_add (files, NULL);
+
+    g_hash_table_destroy (seen);
+    return (gchar **) g_ptr_array_free (files, FALSE);
+}
+
+static void bundle_deps (BundlePkg *pkg, GHashTable *installed, GHashTable *seen, GPtrArray *files)
+{
+    BundlePkg *dep;
+    gchar **deps, **alts, *name;
+    gboolean met;
+    int i, j;
+
+    if (g_hash_table_contains (seen, pkg->name)) return;
+    g_hash_table_add (seen, pkg->name);
+    g_ptr_array_add (files, g_build_filename (bundle_dir, pkg->file, NULL));
+    if (!pkg->depends) return;
+
+    // version constraints are not checked - the bundle is expected to hold versions which suit the image
+    deps = g_strsplit (pkg->depends, ",", -1);
+    for (i = 0; deps[i]; i++)
+    {
+        alts = g_strsplit (deps[i], "|", -1);
+        met = FALSE;
+        dep = NULL;
+        for (j = 0; alts[j] && !met; j++)
+        {
+            name = g_strstrip (alts[j]);
+            name[strcspn (name, " (:")] = 0;
+            if (g_hash_table_contains (installed, name) || g_hash_table_contains (seen, name)) met = TRUE;
+            else if (!dep) dep = g_hash_table_lookup (bundle, name);
+        }
+        if (!met && dep) bundle_deps (dep, installed, seen, files);
+        g_strfreev (alts);
+    }
+    g_strfreev (deps);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Resident catalog service                                                   */
+/*----------------------------------------------------------------------------*/
+
+static gboolean service_call (const gchar *request, PkTask *task, GCancellable *cancel, ServiceReply callback)
+{
+    ServiceCall *call;
+    GSocketClient *client;
+    GSocketAddress *addr;
+
+    // returns FALSE if there is no service to ask; otherwise the callback gets the reply lines, or NULL on failure
+    if (!use_service || !g_file_test (SERVICE_SOCKET, G_FILE_TEST_EXISTS)) return FALSE;
+
+    call = g_new0 (ServiceCall, 1);
+    call->task = task;
+    call->request = g_strdup (request);
+    call->cancel = g_object_ref (cancel);
+    call->callback = callback;
+    call->lines = g_ptr_array_new_with_free_func (g_free);
+
+    client = g_socket_client_new ();
+    addr = g_unix_socket_address_new (SERVICE_SOCKET);
+    g_socket_client_connect_async (client, G_SOCKET_CONNECTABLE (addr), call->cancel, service_connected, call);
+    g_object_unref (addr);
+    g_object_unref (client);
     return TRUE;
 }
 
-static char *get_shell_string (char *cmd)
+static void service_connected (GObject *source, GAsyncResult *res, gpointer data)
 {
-    char *line = NULL, *res = NULL;
-    size_t len = 0;
-    FILE *fp = popen (cmd, "r");
+    ServiceCall *call = (ServiceCall *) data;
+    GOutputStream *out;
 
-    if (fp == NULL) return g_strdup ("");
-    if (getline (&line, &len, fp) > 0)
+    call->conn = g_socket_client_connect_finish (G_SOCKET_CLIENT (source), res, NULL);
+    if (!call->conn)
     {
-        g_strdelimit (line, "\n\r", 0);
-        res = line;
-        while (*res++) if (g_ascii_isspace (*res)) *res = 0;
-        res = g_strdup (line);
+        service_done (call, FALSE);
+        return;
     }
-    pclose (fp);
-    g_free (line);
-    return res ? res : g_strdup ("");
+
+    out = g_io_stream_get_output_stream (G_IO_STREAM (call->conn));
+    if (!g_output_stream_write_all (out, call->request, strlen (call->request), NULL, call->cancel, NULL))
+    {
+        service_done (call, FALSE);
+        return;
+    }
+
+    call->in = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (call->conn)));
+    g_data_input_stream_read_line_async (call->in, G_PRIORITY_DEFAULT, call->cancel, service_line, call);
 }
 
-static gboolean net_available (void)
+static void service_line (GObject *source, GAsyncResult *res, gpointer data)
 {
-    char *ip;
-    gboolean val = FALSE;
+    ServiceCall *call = (ServiceCall *) data;
+    gchar *line;
 
-    ip = get_shell_string ("hostname -I | tr ' ' \\\\n | grep \\\\. | tr \\\\n ','");
-    if (ip)
+    line = g_data_input_stream_read_line_finish (call->in, res, NULL, NULL);
+    if (!line || g_str_has_prefix (line, "ERROR"))
     {
-        if (strlen (ip)) val = TRUE;
-        g_free (ip);
+        g_free (line);
+        service_done (call, FALSE);
     }
-    return val;
+    else if (!g_strcmp0 (line, "END"))
+    {
+        g_free (line);
+        service_done (call, TRUE);
+    }
+    else
+    {
+        g_ptr_array_add (call->lines, line);
+        g_data_input_stream_read_line_async (call->in, G_PRIORITY_DEFAULT, call->cancel, service_line, call);
+    }
+}
+
+static void service_done (ServiceCall *call, gboolean ok)
+{
+    // after any failure, go straight to PackageKit for the rest of the session
+    if (!ok && !g_cancellable_is_cancelled (call->cancel)) use_service = FALSE;
+    call->callback (call->task, ok ? call->lines : NULL);
+
+    g_ptr_array_free (call->lines, TRUE);
+    if (call->in) g_object_unref (call->in);
+    if (call->conn) g_object_unref (call->conn);
+    g_object_unref (call->cancel);
+    g_free (call->request);
+    g_free (call);
 }
 
 /*----------------------------------------------------------------------------*/
-/* Helper functions for tree views                                            */
+/* Headless pre-warm, run by the rp-prefapps-prewarm timer                    */
 /*----------------------------------------------------------------------------*/
 
-static const char *cat_icon_name (char *category)
+static int prewarm (void)
 {
-    if (!g_strcmp0 (category, N_("Programming")))
-        return "applications-development";
-
-    if (!g_strcmp0 (category, N_("Office")))
-        return "applications-office";
-
-    if (!g_strcmp0 (category, N_("Internet")))
-        return "applications-internet";
-
-    if (!g_strcmp0 (category, N_("Games")))
-        return "applications-games";
+    double load;
 
-    if (!g_strcmp0 (category, N_("Other")))
-        return "applications-other";
+    // the timer and service units already ask for idle priority; this covers being run by hand
+    if (nice (19) == -1) g_printerr ("rp-prefapps: unable to lower priority\n");
+    if (getloadavg (&load, 1) == 1 && load > PREWARM_MAX_LOAD)
+    {
+        g_printerr ("rp-prefapps: system busy - skipping pre-warm\n");
+        return 0;
+    }
 
-    if (!g_strcmp0 (category, N_("Accessories")))
-        return "applications-accessories";
+    prewarm_loop = g_main_loop_new (NULL, FALSE);
+    prewarm_status = 0;
 
-    if (!g_strcmp0 (category, N_("Sound & Video")))
-        return "applications-multimedia";
+    // the service holds the resolved catalog and details, so a refresh through it is all that can be kept warm without it
+    if (!service_call ("REFRESH\n", NULL, cancellable, prewarm_refreshed))
+    {
+        g_printerr ("rp-prefapps: catalog service not available - refreshing package cache only\n");
+        pk_client_refresh_cache_async (PK_CLIENT (session), FALSE, cancellable, NULL, NULL, (GAsyncReadyCallback) prewarm_direct_done, NULL);
+    }
 
-    if (!g_strcmp0 (category, N_("System Tools")))
-        return "applications-system";
+    g_main_loop_run (prewarm_loop);
+    g_main_loop_unref (prewarm_loop);
+    if (prewarm_names) g_ptr_array_free (prewarm_names, TRUE);
+    if (prewarm_found) g_ptr_array_free (prewarm_found, TRUE);
+    free_catalog ();
+    return prewarm_status;
+}
 
-    if (!g_strcmp0 (category, N_("Engineering")))
-        return "applications-engineering";
+static void prewarm_refreshed (PkTask *task, GPtrArray *lines)
+{
+    GPtrArray *pnames;
+    GHashTable *seen;
+    CatEntry *e;
+    gchar **langs, **adds;
+    int i, j, k;
 
-    if (!g_strcmp0 (category, N_("Education")))
-        return "applications-science";
+    // a failed refresh, say with no network, still leaves the existing cache worth resolving through the service
+    if (!lines) use_service = TRUE;
 
-    if (!g_strcmp0 (category, N_("Graphics")))
-        return "applications-graphics";
+    catalog = prefapps_catalog_load (NULL);
+    if (!catalog)
+    {
+        g_printerr ("rp-prefapps: unable to open package data file\n");
+        prewarm_status = 1;
+        g_main_loop_quit (prewarm_loop);
+        return;
+    }
 
-    if (!g_strcmp0 (category, N_("Science & Maths")))
-        return "applications-science";
+    pnames = g_ptr_array_new ();
+    for (i = 0; i < catalog->entries->len; i++)
+    {
+        e = g_ptr_array_index (catalog->entries, i);
+        if (!(e->flags & ENTRY_HIDDEN)) prefapps_entry_names (catalog, e, lang, lang_loc, pnames);
+    }
 
-    if (!g_strcmp0 (category, N_("Preferences")))
-        return "preferences-desktop";
+    // the timer runs in the system locale, but users may run the application in any language the catalog is
+    // translated into, so the language packages for each of those are warmed as well
+    langs = prefapps_catalog_languages ();
+    for (j = 0; langs[j]; j++)
+    {
+        if (!g_strcmp0 (langs[j], lang)) continue;
+        for (i = 0; i < catalog->entries->len; i++)
+        {
+            e = g_ptr_array_index (catalog->entries, i);
+            if ((e->flags & ENTRY_HIDDEN) || !e->str[CF_ADDITIONAL] || !*e->str[CF_ADDITIONAL]) continue;
+            adds = prefapps_expand_additional (e->str[CF_ADDITIONAL], langs[j], NULL);
+            for (k = 0; adds[k]; k++) g_ptr_array_add (pnames, g_string_chunk_insert_const (catalog->strings, adds[k]));
+            g_strfreev (adds);
+        }
+    }
+    g_strfreev (langs);
 
-    if (!g_strcmp0 (category, N_("Universal Access")))
-        return "preferences-desktop-accessibility";
+    // names shared between entries or languages are only asked for once
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < pnames->len; i++)
+    {
+        if (g_hash_table_contains (seen, g_ptr_array_index (pnames, i))) g_ptr_array_remove_index (pnames, i--);
+        else g_hash_table_add (seen, g_ptr_array_index (pnames, i));
+    }
+    g_hash_table_destroy (seen);
 
-    return NULL;
+    prewarm_names = pnames;
+    prewarm_next = 0;
+    prewarm_found = g_ptr_array_new_with_free_func (g_object_unref);
+    prewarm_send ("RESOLVE", prewarm_resolved);
 }
 
-static gboolean match_category (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+static void prewarm_resolved (PkTask *task, GPtrArray *lines)
 {
-    GtkTreeModel *cmodel;
-    GtkTreeIter citer;
-    GtkTreeSelection *sel;
-    char *id, *rid, *pcat, *desc, *cat;
-    const gchar *search;
-    gboolean res;
+    PkPackage *item;
+    GHashTable *best;
+    GHashTableIter iter;
+    gpointer id;
+    gchar **fields;
+    int i;
 
-    // get the current category selection from the category box
-    sel = gtk_tree_view_get_selection (GTK_TREE_VIEW (cat_tv));
-    if (sel && gtk_tree_selection_get_selected (sel, &cmodel, &citer))
+    if (!lines)
     {
-        gtk_tree_model_get (cmodel, &citer, CAT_NAME, &cat, -1);
+        g_printerr ("rp-prefapps: unable to resolve catalog packages\n");
+        prewarm_status = 1;
+        g_main_loop_quit (prewarm_loop);
+        return;
     }
-    else cat = g_strdup ("All Programs");
 
-    // first make sure the package has a package ID - ignore if not
-    gtk_tree_model_get (model, iter, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, PACK_CATEGORY, &pcat, PACK_CELL_DESC, &desc, -1);
-    if (!g_strcmp0 (id, "none") && !g_strcmp0 (rid, "none")) res = FALSE;
-    else
+    // each line is PACKAGE <info> <id> - rebuild the packages, as a resolve from the application does
+    for (i = 0; i < lines->len; i++)
     {
-        // check that category matches
-        if (!g_strcmp0 (cat, "All Programs")) res = TRUE;
-        else
-        {
-            if (!g_strcmp0 (cat, pcat)) res = TRUE;
-            else res = FALSE;
-        }
-
-        // filter on search text
-        if (res)
+        fields = g_strsplit (g_ptr_array_index (lines, i), " ", 3);
+        if (g_strv_length (fields) == 3 && !g_strcmp0 (fields[0], "PACKAGE"))
         {
-            search = gtk_entry_get_text (GTK_ENTRY (search_te));
-            if (search[0])
+            item = pk_package_new ();
+            if (pk_package_set_id (item, fields[2], NULL) && filter_fn (item, NULL))
             {
-                if (!strcasestr (desc, search)) res = FALSE;
+                g_object_set (item, "info", atoi (fields[1]), NULL);
+                g_ptr_array_add (prewarm_found, item);
             }
+            else g_object_unref (item);
         }
+        g_strfreev (fields);
     }
-    g_free (id);
-    g_free (rid);
-    g_free (pcat);
-    g_free (desc);
-    g_free (cat);
-    return res;
+    if (prewarm_next < prewarm_names->len)
+    {
+        prewarm_send ("RESOLVE", prewarm_resolved);
+        return;
+    }
+
+    // the application only asks for details of the version it chooses for each name, so only those are warmed
+    best = prefapps_best_ids (prewarm_found);
+    g_ptr_array_free (prewarm_names, TRUE);
+    prewarm_names = g_ptr_array_new_with_free_func (g_free);
+    prewarm_next = 0;
+    g_hash_table_iter_init (&iter, best);
+    while (g_hash_table_iter_next (&iter, NULL, &id)) g_ptr_array_add (prewarm_names, g_strdup ((gchar *) id));
+    g_hash_table_destroy (best);
+
+    if (prewarm_names->len) prewarm_send ("DETAILS", prewarm_done);
+    else g_main_loop_quit (prewarm_loop);
 }
 
-static gboolean packs_in_cat (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+static void prewarm_done (PkTask *task, GPtrArray *lines)
 {
-    GtkTreeIter piter;
-    gboolean valid;
-    gchar *pcat, *tcat, *id, *rid;
+    if (!lines)
+    {
+        g_printerr ("rp-prefapps: unable to read package details\n");
+        prewarm_status = 1;
+    }
+    else if (prewarm_next < prewarm_names->len)
+    {
+        prewarm_send ("DETAILS", prewarm_done);
+        return;
+    }
+    g_main_loop_quit (prewarm_loop);
+}
 
-	// get the category under test
-    gtk_tree_model_get (model, iter, CAT_NAME, &tcat, -1);
+static void prewarm_send (const gchar *command, ServiceReply callback)
+{
+    GString *req;
+    int n;
 
-    // always show All Programs category
-    if (!g_strcmp0 (tcat, "All Programs")) return TRUE;
+    req = g_string_new (command);
+    for (n = 0; n < RESOLVE_CHUNK && prewarm_next < prewarm_names->len; n++)
+        g_string_append_printf (req, " %s", (gchar *) g_ptr_array_index (prewarm_names, prewarm_next++));
+    g_string_append (req, "\n");
 
-	// loop through all packages in database - show category only if it matches a program with a valid ID
-    valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (packages), &piter);
-    while (valid)
+    if (!service_call (req->str, NULL, cancellable, callback))
     {
-        gtk_tree_model_get (GTK_TREE_MODEL (packages), &piter, PACK_CATEGORY, &pcat, PACK_PACKAGE_ID, &id, PACK_RPACKAGE_ID, &rid, -1);
-        if (!g_strcmp0 (pcat, tcat) && (g_strcmp0 (id, "none") || g_strcmp0 (rid, "none")))
-        {
-			g_free (tcat);
-			g_free (pcat);
-			g_free (id);
-			g_free (rid);
-			return TRUE;
-		}
+        prewarm_status = 1;
+        g_main_loop_quit (prewarm_loop);
+    }
+    g_string_free (req, TRUE);
+}
 
-        g_free (pcat);
-		g_free (id);
-		g_free (rid);
-        valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (packages), &piter);
+static void prewarm_direct_done (PkClient *client, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+    PkError *pkerror = NULL;
+    GError *error = NULL;
+
+    results = pk_client_generic_finish (client, res, &error);
+    if (results) pkerror = pk_results_get_error_code (results);
+    if (error || pkerror)
+    {
+        g_printerr ("rp-prefapps: %s\n", error ? error->message : pk_error_get_details (pkerror));
+        prewarm_status = 1;
     }
-    g_free (tcat);
-    return FALSE;
+
+    if (error) g_error_free (error);
+    if (pkerror) g_object_unref (pkerror);
+    if (results) g_object_unref (results);
+    g_main_loop_quit (prewarm_loop);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -1246,8 +4189,6 @@ static gboolean packs_in_cat (GtkTreeModel *model, GtkTreeIter *iter, gpointer d
 
 static gboolean reload (GtkButton *button, gpointer data)
 {
-    PkTask *task;
-
     if (msg_dlg)
     {
         gtk_widget_destroy (GTK_WIDGET (msg_dlg));
@@ -1261,10 +4202,21 @@ static gboolean reload (GtkButton *button, gpointer data)
 
     message (_("Updating package data - please wait..."), 0 , -1);
 
+    est_short = FALSE;
+    gtk_label_set_text (GTK_LABEL (size_lbl), "");
+
+    // any details still on their way belong to the old list
+    if (det_cancel)
+    {
+        g_cancellable_cancel (det_cancel);
+        g_object_unref (det_cancel);
+        det_cancel = NULL;
+    }
+    if (det_requested) g_hash_table_remove_all (det_requested);
+
     gtk_list_store_clear (packages);
     gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (gtk_tree_view_get_model (GTK_TREE_VIEW (pack_tv))));
-    task = pk_task_new ();
-    reload_data_file (task);
+    reload_data_file (session);
     return FALSE;
 }
 
@@ -1289,6 +4241,16 @@ static gboolean quit (GtkButton *button, gpointer data)
 
 static void error_box (char *msg, gboolean terminal)
 {
+    stage_active = FALSE;
+
+    // with the window gone, the failure can only be reported by a notification
+    if (detached)
+    {
+        notify (_("Changes to applications failed"), msg);
+        gtk_main_quit ();
+        return;
+    }
+
     if (msg_dlg)
     {
         // clear any existing message box
@@ -1340,6 +4302,19 @@ static void error_box (char *msg, gboolean terminal)
 
 static void message (char *msg, int wait, int prog)
 {
+    // while the list is being filled in or batches are running, show progress under it rather than in front of it
+    if ((pending || batch) && !wait && !msg_dlg)
+    {
+        if (batches && !g_queue_is_empty (batches))
+        {
+            char *buf = g_strdup_printf (_("%s (%d more queued)"), msg, g_queue_get_length (batches));
+            gtk_label_set_text (GTK_LABEL (size_lbl), buf);
+            g_free (buf);
+        }
+        else gtk_label_set_text (GTK_LABEL (size_lbl), msg);
+        return;
+    }
+
     if (err_dlg)
     {
         // clear any existing error box
@@ -1371,6 +4346,7 @@ static void message (char *msg, int wait, int prog)
         msg_pb = (GtkWidget *) gtk_builder_get_object (builder, "msg_pb");
         msg_btn = (GtkWidget *) gtk_builder_get_object (builder, "msg_btn");
         msg_cancel = (GtkWidget *) gtk_builder_get_object (builder, "msg_cancel");
+        g_signal_connect (msg_cancel, "clicked", G_CALLBACK (cancel_handler), NULL);
 
         gtk_label_set_text (GTK_LABEL (msg_msg), msg);
 
@@ -1385,8 +4361,10 @@ static void message (char *msg, int wait, int prog)
         if (wait > 1)
         {
             gtk_button_set_label (GTK_BUTTON (msg_btn), "_Yes");
-            g_signal_connect (msg_btn, "clicked", G_CALLBACK (quit), (void *) 1);
-            g_signal_connect (msg_cancel, "clicked", G_CALLBACK (quit), (void *) 0);
+            gtk_button_set_label (GTK_BUTTON (msg_cancel), "_No");
+            // the same question answers the reboot prompt on quitting and the offer to resume interrupted changes
+            g_signal_connect (msg_btn, "clicked", G_CALLBACK (resume ? resume_response : quit), (void *) 1);
+            g_signal_connect (msg_cancel, "clicked", G_CALLBACK (resume ? resume_response : quit), (void *) 0);
             gtk_widget_set_visible (msg_cancel, TRUE);
         }
         else
@@ -1399,7 +4377,8 @@ static void message (char *msg, int wait, int prog)
     }
     else
     {
-        gtk_widget_set_visible (msg_cancel, FALSE);
+        gtk_button_set_label (GTK_BUTTON (msg_cancel), "_Cancel");
+        gtk_widget_set_visible (msg_cancel, can_cancel && !g_cancellable_is_cancelled (cancellable));
         gtk_widget_set_visible (msg_btn, FALSE);
         gtk_widget_set_visible (msg_pb, TRUE);
         if (prog == -1) gtk_progress_bar_pulse (GTK_PROGRESS_BAR (msg_pb));
@@ -1437,80 +4416,165 @@ static void category_selected (GtkTreeView *tv, gpointer ptr)
     gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (model));
     gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (pack_tv), path, NULL, TRUE, 0.0, 0.0);
     gtk_tree_path_free (path);
+    queue_details ();
+}
+
+static void update_cell_text (GtkTreeIter *iter)
+{
+    set_cell_text (packages, iter);
+}
+
+static void set_cell_text (GtkListStore *store, GtkTreeIter *iter)
+{
+    gboolean val, init, queued;
+    gchar *name, *desc, *size, *buf, *state, *upd;
+
+    gtk_tree_model_get (GTK_TREE_MODEL (store), iter, PACK_INSTALLED, &val, PACK_INIT_INST, &init, PACK_CELL_NAME, &name, PACK_CELL_DESC, &desc, PACK_SIZE, &size, PACK_QUEUED, &queued,
+        PACK_UPDATE_ID, &upd, -1);
+
+    if (queued)
+    {
+        if (init && val) state = g_strdup (_("   <b><small>(queued for update)</small></b>"));
+        else if (val) state = g_strdup (_("   <b><small>(queued for installation)</small></b>"));
+        else state = g_strdup (_("   <b><small>(queued for removal)</small></b>"));
+    }
+    else if (!init && val)
+    {
+        if (size) state = g_strdup_printf (_("   <b><small>(will be installed - %s)</small></b>"), size);
+        else state = g_strdup (_("   <b><small>(will be installed)</small></b>"));
+    }
+    else if (init && !val) state = g_strdup (_("   <b><small>(will be removed)</small></b>"));
+    else if (pending) state = g_strdup (_("   <i><small>(checking...)</small></i>"));
+    else if (init && g_strcmp0 (upd, "none")) state = g_strdup (_("   <small>(update available)</small>"));
+    else state = g_strdup ("");
+
+    buf = g_strdup_printf (_("<b>%s</b>%s\n%s"), name, state, desc);
+    gtk_list_store_set (store, iter, PACK_CELL_TEXT, buf, -1);
+    g_free (buf);
+    g_free (state);
+    g_free (name);
+    g_free (desc);
+    g_free (size);
+    g_free (upd);
 }
 
 static void install_toggled (GtkCellRendererToggle *cell, gchar *path, gpointer user_data)
 {
     GtkTreeIter iter, citer, siter;
     GtkTreeModel *model, *cmodel, *smodel;
-    gboolean val, init;
-    gchar *name, *desc, *buf, *state;
+    gboolean val, queued;
 
     model = gtk_tree_view_get_model (GTK_TREE_VIEW (pack_tv));
     gtk_tree_model_get_iter_from_string (model, &iter, path);
 
+    // nothing is known about what is installed until the packages have been found
+    if (pending) return;
+
     cmodel = gtk_tree_model_filter_get_model (GTK_TREE_MODEL_FILTER (model));
     gtk_tree_model_filter_convert_iter_to_child_iter (GTK_TREE_MODEL_FILTER (model), &citer, &iter);
 
     smodel = gtk_tree_model_sort_get_model (GTK_TREE_MODEL_SORT (cmodel));
     gtk_tree_model_sort_convert_iter_to_child_iter (GTK_TREE_MODEL_SORT (cmodel), &siter, &citer);
 
-    gtk_tree_model_get (smodel, &siter, PACK_INSTALLED, &val, PACK_INIT_INST, &init, PACK_CELL_NAME, &name, PACK_CELL_DESC, &desc, -1);
+    // entries waiting in a batch keep the state they were applied with
+    gtk_tree_model_get (smodel, &siter, PACK_INSTALLED, &val, PACK_QUEUED, &queued, -1);
+    if (queued) return;
+    gtk_list_store_set (GTK_LIST_STORE (smodel), &siter, PACK_INSTALLED, 1 - val, PACK_SIZE, NULL, -1);
+    update_cell_text (&siter);
 
-    if (!init && !val) state = g_strdup (_("   <b><small>(will be installed)</small></b>"));
-    else if (init && val) state = g_strdup (_("   <b><small>(will be removed)</small></b>"));
-    else state = g_strdup ("");
+    schedule_estimate ();
+}
 
-    buf = g_strdup_printf (_("<b>%s</b>%s\n%s"), name, state, desc);
-    gtk_list_store_set (GTK_LIST_STORE (smodel), &siter, PACK_INSTALLED, 1 - val, PACK_CELL_TEXT, buf, -1);
-    g_free (buf);
-    g_free (state);
-    g_free (name);
-    g_free (desc);
+static void cancel_handler (GtkButton* btn, gpointer ptr)
+{
+    // the same button is No on the reboot prompt - only act if an operation is running
+    if ((!msg_dlg || !gtk_widget_get_visible (msg_pb)) && !batch) return;
+    if (!can_cancel || g_cancellable_is_cancelled (cancellable)) return;
+
+    can_cancel = FALSE;
+    message (_("Cancelling - please wait..."), 0, -1);
+    g_cancellable_cancel (cancellable);
+    if (apt_pid) kill (apt_pid, SIGTERM);
+
+    // if waiting to retry, restart the stage now so that it fails straight away as cancelled
+    if (retry_id)
+    {
+        g_source_remove (retry_id);
+        retry_timeout (NULL);
+    }
+
+    // likewise if waiting for another program to release the package manager lock
+    if (lock_then) lock_resume ();
 }
 
-static void close_handler (GtkButton* btn, gpointer ptr)
+static gboolean close_handler (GtkButton* btn, gpointer ptr)
 {
-    if (needs_reboot)
+    if ((msg_dlg && gtk_widget_get_visible (msg_pb)) || batch)
+    {
+        // stop whatever is running and quit once it has unwound - leave it be if it can't be interrupted
+        if (can_cancel || g_cancellable_is_cancelled (cancellable))
+        {
+            quit_on_cancel = TRUE;
+            cancel_handler (NULL, NULL);
+        }
+    }
+    else if (needs_reboot)
         message (_("An installed application requires a reboot.\nWould you like to reboot now?"), 2, -1);
     else
         gtk_main_quit ();
+    return TRUE;
 }
 
 static gboolean search_update (GtkEditable *editable, gpointer userdata)
 {
     gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (gtk_tree_view_get_model (GTK_TREE_VIEW (pack_tv))));
+    queue_details ();
 }
 
-static void get_locales (void)
+static void packs_scrolled (GtkAdjustment *adj, gpointer userdata)
 {
-    char *lstring = setlocale (LC_CTYPE, NULL);
-    if (lstring && *lstring)
+    queue_details ();
+}
+
+static void read_settings (void)
+{
+    GKeyFile *kf;
+    GError *err = NULL;
+    const char *keys[NUM_STAGES] = { NULL, "refresh", "resolve", "install", "remove", "self_update" };
+    int i, val;
+
+    // all keys are optional - anything missing or malformed keeps its default
+    kf = g_key_file_new ();
+    if (g_key_file_load_from_file (kf, PACKAGE_SYSCONF_DIR "/rp-prefapps.conf", G_KEY_FILE_NONE, NULL))
     {
-        char *lastr = strtok (lstring, "_");
-        char *lostr = strtok (NULL, ". ");
-        if (lastr && *lastr)
-        {
-            lang = g_strdup (lastr);
-            if (lostr && *lostr)
-            {
-                char *str = g_ascii_strdown (lostr, -1);
-                lang_loc = g_strdup_printf ("%s-%s", lang, str);
-                g_free (str);
-            }
-            else lang_loc = g_strdup ("");
-        }
-        else
+        for (i = 1; i < NUM_STAGES; i++)
         {
-            lang = g_strdup ("");
-            lang_loc = g_strdup ("");
+            val = g_key_file_get_integer (kf, "Timeouts", keys[i], &err);
+            if (!err && val >= 0) stage_timeout[i] = val;
+            g_clear_error (&err);
         }
+
+        val = g_key_file_get_integer (kf, "Timeouts", "watchdog", &err);
+        if (!err && val >= 0) watchdog_timeout = val;
+        g_clear_error (&err);
+
+        val = g_key_file_get_integer (kf, "Timeouts", "retries", &err);
+        if (!err && val >= 0) max_retries = val;
+        g_clear_error (&err);
+
+        val = g_key_file_get_integer (kf, "List", "fixed_rows", &err);
+        if (!err && val >= 0) fixed_rows_above = val;
+        g_clear_error (&err);
+
+        val = g_key_file_get_integer (kf, "Log", "max_size", &err);
+        if (!err && val >= 0) txlog_max_size = val;
+        g_clear_error (&err);
+
+        val = g_key_file_get_integer (kf, "Log", "keep", &err);
+        if (!err && val >= 0) txlog_keep = val;
+        g_clear_error (&err);
     }
-    else
-    {
-        lang = g_strdup ("");
-        lang_loc = g_strdup ("");
-    }
+    g_key_file_free (kf);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -1520,7 +4584,12 @@ static void get_locales (void)
 int main (int argc, char *argv[])
 {
     GtkBuilder *builder;
-    GtkCellRenderer *crp, *crt, *crb;
+    GtkCellRenderer *crp, *crt, *crb, *crtp;
+
+    // contact PackageKit before anything else, so the daemon is started and the system bus connected while the
+    // probes below run and the UI is built, rather than when the first transaction is sent
+    session = pk_task_new ();
+    g_thread_unref (g_thread_new ("session", session_warm, NULL));
 
 #ifdef ENABLE_NLS
     setlocale (LC_ALL, "");
@@ -1531,8 +4600,13 @@ int main (int argc, char *argv[])
 
     if (system ("raspi-config nonint is_pi")) is_pi = FALSE;
 
-    get_locales ();
+    prefapps_get_locales (&lang, &lang_loc);
+    read_settings ();
     needs_reboot = FALSE;
+    cancellable = g_cancellable_new ();
+
+    // pre-warm the catalog service's caches without showing any UI
+    if (argc > 1 && !g_strcmp0 (argv[1], "--prewarm")) return prewarm ();
 
     // GTK setup
     gdk_threads_init ();
@@ -1549,19 +4623,20 @@ int main (int argc, char *argv[])
     pack_tv = (GtkWidget *) gtk_builder_get_object (builder, "treeview_prog");
     close_btn = (GtkWidget *) gtk_builder_get_object (builder, "button_cancel");
     apply_btn = (GtkWidget *) gtk_builder_get_object (builder, "button_ok");
+    update_btn = (GtkWidget *) gtk_builder_get_object (builder, "button_update");
+    bg_btn = (GtkWidget *) gtk_builder_get_object (builder, "button_background");
     search_te = (GtkWidget *) gtk_builder_get_object (builder, "search");
+    size_lbl = (GtkWidget *) gtk_builder_get_object (builder, "size_lbl");
 
     // create list stores
-    categories = gtk_list_store_new (3, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING);
-    packages = gtk_list_store_new (19, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_STRING,
-        G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
-        G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING,
-        G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_BOOLEAN);
+    categories = categories_store_new ();
+    packages = packages_store_new ();
 
     // set up tree views
     crp = gtk_cell_renderer_pixbuf_new ();
     crt = gtk_cell_renderer_text_new ();
     crb = gtk_cell_renderer_toggle_new ();
+    crtp = gtk_cell_renderer_text_new ();
 
     gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (cat_tv), 0, "Icon", crp, "pixbuf", CAT_ICON, NULL);
     gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (cat_tv), 1, "Category", crt, "text", CAT_DISP_NAME, NULL);
@@ -1571,22 +4646,26 @@ int main (int argc, char *argv[])
     gtk_tree_view_set_tooltip_column (GTK_TREE_VIEW (pack_tv), PACK_DESCRIPTION);
 
     gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (pack_tv), 0, "", crp, "pixbuf", PACK_ICON, NULL);
-    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (pack_tv), 1, _("Application"), crt, "markup", PACK_CELL_TEXT, NULL);
+    gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (pack_tv), 1, _("Application"), crtp, "markup", PACK_CELL_TEXT, NULL);
     gtk_tree_view_insert_column_with_attributes (GTK_TREE_VIEW (pack_tv), 2, _("Install"), crb, "active", PACK_INSTALLED, NULL);
 
     gtk_tree_view_column_set_sizing (gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 0), GTK_TREE_VIEW_COLUMN_FIXED);
     gtk_tree_view_column_set_fixed_width (gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 0), 45);
     gtk_tree_view_column_set_expand (gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 1), TRUE);
-    g_object_set (crt, "wrap-mode", PANGO_WRAP_WORD, "wrap-width", 320, NULL);
+    g_object_set (crtp, "wrap-mode", PANGO_WRAP_WORD, "wrap-width", 320, NULL);
     gtk_tree_view_column_set_sizing (gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 2), GTK_TREE_VIEW_COLUMN_FIXED);
     gtk_tree_view_column_set_fixed_width (gtk_tree_view_get_column (GTK_TREE_VIEW (pack_tv), 2), 50);
 
     g_signal_connect (crb, "toggled", G_CALLBACK (install_toggled), NULL);
     g_signal_connect (close_btn, "clicked", G_CALLBACK (close_handler), NULL);
     g_signal_connect (apply_btn, "clicked", G_CALLBACK (install_handler), NULL);
+    g_signal_connect (update_btn, "clicked", G_CALLBACK (update_handler), NULL);
+    g_signal_connect (bg_btn, "clicked", G_CALLBACK (background_handler), NULL);
     g_signal_connect (main_dlg, "delete_event", G_CALLBACK (close_handler), NULL);
     g_signal_connect (gtk_tree_view_get_selection (GTK_TREE_VIEW (cat_tv)), "changed", G_CALLBACK (category_selected), NULL);
     g_signal_connect (search_te, "changed", G_CALLBACK (search_update), NULL);
+    g_signal_connect (gtk_tree_view_get_vadjustment (GTK_TREE_VIEW (pack_tv)), "value-changed", G_CALLBACK (packs_scrolled), NULL);
+    g_signal_connect (gtk_tree_view_get_vadjustment (GTK_TREE_VIEW (pack_tv)), "changed", G_CALLBACK (packs_scrolled), NULL);
 
     gtk_widget_set_sensitive (close_btn, FALSE);
     gtk_widget_set_sensitive (apply_btn, FALSE);
@@ -1597,7 +4676,22 @@ int main (int argc, char *argv[])
     // update application, load the data file and check with backend
     if (argc > 1 && !g_strcmp0 (argv[1], "noupdate")) no_update = TRUE;
 
-    if (net_available ())
+    // read the catalog while the checks below run - it is shown as soon as it has been read, and its entries are
+    // filled in once their packages have been found
+    sel_cat = g_strdup_printf ("0");
+    load_data_file (TRUE);
+
+    // with a local bundle of packages, there is nothing to fetch, so no need for a network
+    if (argc > 2 && !g_strcmp0 (argv[1], "--bundle"))
+    {
+        if (load_bundle (argv[2]))
+        {
+            no_update = TRUE;
+            g_idle_add (update_self, NULL);
+        }
+        else error_box (_("Unable to read package bundle index"), TRUE);
+    }
+    else if (net_available ())
     {
         if (clock_synced ()) g_idle_add (update_self, NULL);
         else
@@ -1609,12 +4703,13 @@ int main (int argc, char *argv[])
     }
     else error_box (_("No network connection - applications cannot be installed"), TRUE);
 
-    sel_cat = g_strdup_printf ("0");
+    g_timeout_add_seconds (1, watchdog, NULL);
 
     gtk_main ();
 
     g_object_unref (builder);
     gtk_widget_destroy (main_dlg);
+    g_object_unref (cancellable);
     gdk_threads_leave ();
     return 0;
 }
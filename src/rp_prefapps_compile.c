@@ -0,0 +1,369 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* rp-prefapps-compile - validate package data files and compile them into a binary catalog
+ *
+ * Usage: rp-prefapps-compile [-i icondir] -o prefapps.cat prefapps.conf [prefapps_<lang>.conf ...]
+ *
+ * The first file is the base catalog; any further files are treated as translations, with the
+ * language taken from the file name, and are stored as overlays holding only the strings which
+ * differ from the base.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "prefapps.h"
+
+static const gchar *keys[CF_NUM_FIELDS] = CATALOG_KEYS;
+
+typedef struct {
+    gchar *str[CF_NUM_FIELDS];
+    guint32 flags;
+} Entry;
+
+GByteArray *strtab;
+GHashTable *interned;
+const gchar *icon_dir;
+int errors;
+
+/*----------------------------------------------------------------------------*/
+/* Validation                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static void fail (const gchar *file, const gchar *group, const gchar *fmt, ...)
+{
+    va_list args;
+    gchar *msg;
+
+    va_start (args, fmt);
+    msg = g_strdup_vprintf (fmt, args);
+    va_end (args);
+    fprintf (stderr, "%s: [%s] %s\n", file, group, msg);
+    g_free (msg);
+    errors++;
+}
+
+static gboolean valid_arch (const gchar *arch)
+{
+    gchar *expr, **alts;
+    int len, i;
+    gboolean ret = TRUE;
+
+    // arch expressions are a grep pattern of alternatives, e.g. "armv7l\|aarch64", optionally quoted
+    len = strlen (arch);
+    if (len >= 2 && arch[0] == '"' && arch[len - 1] == '"') expr = g_strndup (arch + 1, len - 2);
+    else expr = g_strdup (arch);
+
+    alts = g_strsplit (expr, "\\|", -1);
+    for (i = 0; alts[i]; i++)
+    {
+        const gchar *c = alts[i];
+        if (!*c) ret = FALSE;
+        for (; *c; c++) if (!isalnum (*c) && *c != '_') ret = FALSE;
+    }
+    if (!alts[0]) ret = FALSE;
+    g_strfreev (alts);
+    g_free (expr);
+    return ret;
+}
+
+static gboolean valid_additional (const gchar *adds)
+{
+    gchar **list, *pct, *sub;
+    int i;
+    gboolean ret = TRUE;
+
+    list = g_strsplit (adds, ",", -1);
+    for (i = 0; list[i]; i++)
+    {
+        // at most one %s, which is substituted with the locale before the name is checked
+        pct = strchr (list[i], '%');
+        if (pct && (pct[1] != 's' || strchr (pct + 1, '%'))) ret = FALSE;
+        else
+        {
+            sub = pct ? g_strdup_printf (list[i], "en") : g_strdup (list[i]);
+            if (!prefapps_valid_name (sub)) ret = FALSE;
+            g_free (sub);
+        }
+    }
+    g_strfreev (list);
+    return ret;
+}
+
+static gboolean icon_exists (const gchar *icon)
+{
+    const gchar *exts[] = { ".png", ".svg", ".xpm", NULL };
+    gchar *path;
+    int i;
+    gboolean ret = FALSE;
+
+    for (i = 0; exts[i] && !ret; i++)
+    {
+        path = g_strdup_printf ("%s/%s%s", icon_dir, icon, exts[i]);
+        ret = g_file_test (path, G_FILE_TEST_IS_REGULAR);
+        g_free (path);
+    }
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Loading                                                                    */
+/*----------------------------------------------------------------------------*/
+
+static GPtrArray *load_file (const gchar *file, gboolean base)
+{
+    GVariant *list, *dict;
+    GVariantIter iter;
+    GError *err = NULL;
+    GPtrArray *entries;
+    GHashTable *packs, *names;
+    const gchar *group, *val;
+    Entry *e;
+    int f;
+
+    // parsed by the library, so the catalog holds exactly what the application would read from the text file
+    list = prefapps_parse_conf (file, &err);
+    if (!list)
+    {
+        fprintf (stderr, "%s: %s\n", file, err->message);
+        g_error_free (err);
+        errors++;
+        return NULL;
+    }
+
+    entries = g_ptr_array_new ();
+    packs = g_hash_table_new (g_str_hash, g_str_equal);
+    names = g_hash_table_new (g_str_hash, g_str_equal);
+    g_variant_iter_init (&iter, list);
+    while (g_variant_iter_next (&iter, "(&s@a{ss})", &group, &dict))
+    {
+        e = g_new0 (Entry, 1);
+        e->str[CF_GROUP] = g_strdup (group);
+        for (f = CF_CATEGORY; f < CF_NUM_FIELDS; f++)
+            if (!g_variant_lookup (dict, keys[f], "s", &e->str[f])) e->str[f] = NULL;
+        if (g_variant_lookup (dict, "reboot", "&s", &val) && prefapps_conf_bool (val)) e->flags |= CATALOG_REBOOT;
+        if (g_variant_lookup (dict, "rpdesc", "&s", &val) && prefapps_conf_bool (val)) e->flags |= CATALOG_RPDESC;
+        g_ptr_array_add (entries, e);
+        g_variant_unref (dict);
+
+        if (!e->str[CF_NAME] || !*e->str[CF_NAME]) fail (file, e->str[CF_GROUP], "missing name");
+        else if (g_hash_table_contains (names, e->str[CF_NAME])) fail (file, e->str[CF_GROUP], "duplicate name '%s'", e->str[CF_NAME]);
+        else g_hash_table_add (names, e->str[CF_NAME]);
+
+        if (!e->str[CF_CATEGORY] || !*e->str[CF_CATEGORY]) fail (file, e->str[CF_GROUP], "missing category");
+
+        if (!prefapps_valid_name (e->str[CF_PACKAGE])) fail (file, e->str[CF_GROUP], "missing or invalid package");
+        else if (g_hash_table_contains (packs, e->str[CF_PACKAGE])) fail (file, e->str[CF_GROUP], "duplicate package '%s'", e->str[CF_PACKAGE]);
+        else g_hash_table_add (packs, e->str[CF_PACKAGE]);
+
+        if (e->str[CF_RPACKAGE] && !prefapps_valid_name (e->str[CF_RPACKAGE])) fail (file, e->str[CF_GROUP], "invalid rpackage '%s'", e->str[CF_RPACKAGE]);
+        if (e->str[CF_ARCH] && !valid_arch (e->str[CF_ARCH])) fail (file, e->str[CF_GROUP], "malformed arch expression '%s'", e->str[CF_ARCH]);
+        if (e->str[CF_ADDITIONAL] && !valid_additional (e->str[CF_ADDITIONAL])) fail (file, e->str[CF_GROUP], "malformed additional packages '%s'", e->str[CF_ADDITIONAL]);
+        if (base && icon_dir && e->str[CF_ICON] && !icon_exists (e->str[CF_ICON])) fail (file, e->str[CF_GROUP], "icon '%s' not found in %s", e->str[CF_ICON], icon_dir);
+    }
+
+    g_hash_table_destroy (packs);
+    g_hash_table_destroy (names);
+    g_variant_unref (list);
+    return entries;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Writing                                                                    */
+/*----------------------------------------------------------------------------*/
+
+static guint32 intern (const gchar *str)
+{
+    gpointer off;
+
+    if (!str) return 0;
+    if (g_hash_table_lookup_extended (interned, str, NULL, &off)) return GPOINTER_TO_UINT (off);
+
+    off = GUINT_TO_POINTER (strtab->len);
+    g_byte_array_append (strtab, (const guint8 *) str, strlen (str) + 1);
+    g_hash_table_insert (interned, g_strdup (str), off);
+    return GPOINTER_TO_UINT (off);
+}
+
+static void put_entry (GByteArray *out, const Entry *e, const Entry *base)
+{
+    CatalogEntry ce;
+    int f;
+
+    // for overlays, only store strings which differ from the base entry
+    for (f = 0; f < CF_NUM_FIELDS; f++)
+    {
+        if (base && !g_strcmp0 (e->str[f], base->str[f])) ce.field[f] = 0;
+        else ce.field[f] = GUINT32_TO_LE (intern (e->str[f]));
+    }
+    ce.flags = GUINT32_TO_LE (base ? 0 : e->flags);
+    g_byte_array_append (out, (const guint8 *) &ce, sizeof (CatalogEntry));
+}
+
+static gboolean write_catalog (const gchar *file, GPtrArray *base, GPtrArray **locs, gchar **langs, int n_locs)
+{
+    CatalogHeader hdr;
+    CatalogLocale cl;
+    GByteArray *ents, *out;
+    Entry *e, *le;
+    GError *err = NULL;
+    int i, j, k;
+    gboolean ret;
+
+    strtab = g_byte_array_new ();
+    interned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_byte_array_append (strtab, (const guint8 *) "", 1);
+
+    // base entries, followed by one overlay table per locale, matched to the base by group name
+    ents = g_byte_array_new ();
+    for (i = 0; i < base->len; i++) put_entry (ents, g_ptr_array_index (base, i), NULL);
+    for (j = 0; j < n_locs; j++)
+    {
+        for (i = 0; i < base->len; i++)
+        {
+            e = g_ptr_array_index (base, i);
+            le = NULL;
+            for (k = 0; k < locs[j]->len && !le; k++)
+                if (!g_strcmp0 (((Entry *) g_ptr_array_index (locs[j], k))->str[CF_GROUP], e->str[CF_GROUP]))
+                    le = g_ptr_array_index (locs[j], k);
+            put_entry (ents, le ? le : e, e);
+        }
+    }
+
+    memset (&hdr, 0, sizeof (CatalogHeader));
+    memcpy (hdr.magic, CATALOG_MAGIC, 8);
+    hdr.n_entries = GUINT32_TO_LE (base->len);
+    hdr.n_locales = GUINT32_TO_LE (n_locs);
+    for (j = 0; j < n_locs; j++) intern (langs[j]);
+    while (strtab->len % 4) g_byte_array_append (strtab, (const guint8 *) "", 1);
+    hdr.strings = GUINT32_TO_LE (sizeof (CatalogHeader));
+    hdr.strings_len = GUINT32_TO_LE (strtab->len);
+    hdr.entries = GUINT32_TO_LE (sizeof (CatalogHeader) + strtab->len);
+    hdr.locales = GUINT32_TO_LE (sizeof (CatalogHeader) + strtab->len + base->len * sizeof (CatalogEntry));
+
+    out = g_byte_array_new ();
+    g_byte_array_append (out, (const guint8 *) &hdr, sizeof (CatalogHeader));
+    g_byte_array_append (out, strtab->data, strtab->len);
+    g_byte_array_append (out, (const guint8 *) ents->data, base->len * sizeof (CatalogEntry));
+    for (j = 0; j < n_locs; j++)
+    {
+        cl.lang = GUINT32_TO_LE (intern (langs[j]));
+        cl.overlay = GUINT32_TO_LE (GUINT32_FROM_LE (hdr.locales) + n_locs * sizeof (CatalogLocale) + j * base->len * sizeof (CatalogEntry));
+        g_byte_array_append (out, (const guint8 *) &cl, sizeof (CatalogLocale));
+    }
+    g_byte_array_append (out, ents->data + base->len * sizeof (CatalogEntry), ents->len - base->len * sizeof (CatalogEntry));
+
+    ret = g_file_set_contents (file, (const gchar *) out->data, out->len, &err);
+    if (!ret)
+    {
+        fprintf (stderr, "%s: %s\n", file, err->message);
+        g_error_free (err);
+    }
+
+    g_byte_array_free (out, TRUE);
+    g_byte_array_free (ents, TRUE);
+    g_byte_array_free (strtab, TRUE);
+    g_hash_table_destroy (interned);
+    return ret;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function                                                              */
+/*----------------------------------------------------------------------------*/
+
+int main (int argc, char *argv[])
+{
+    GPtrArray *base, **locs;
+    gchar **langs, *bname, *output = NULL;
+    Entry *le;
+    int i, j, k, n_locs = 0, first;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2)
+    {
+        if (!strcmp (argv[i], "-o")) output = argv[i + 1];
+        else if (!strcmp (argv[i], "-i")) icon_dir = argv[i + 1];
+        else break;
+    }
+    first = i;
+    if (!output || first >= argc)
+    {
+        fprintf (stderr, "Usage: %s [-i icondir] -o catalog prefapps.conf [prefapps_<lang>.conf ...]\n", argv[0]);
+        return 2;
+    }
+
+    base = load_file (argv[first], TRUE);
+    locs = g_new0 (GPtrArray *, argc);
+    langs = g_new0 (gchar *, argc);
+    for (i = first + 1; i < argc; i++)
+    {
+        // language is taken from the file name - prefapps_<lang>.conf
+        bname = g_path_get_basename (argv[i]);
+        if (!g_str_has_prefix (bname, "prefapps_") || !g_str_has_suffix (bname, ".conf"))
+        {
+            fprintf (stderr, "%s: translated data files must be named prefapps_<lang>.conf\n", argv[i]);
+            errors++;
+            g_free (bname);
+            continue;
+        }
+        langs[n_locs] = g_strndup (bname + 9, strlen (bname) - 14);
+        locs[n_locs] = load_file (argv[i], FALSE);
+        if (locs[n_locs]) n_locs++;
+        else g_free (langs[n_locs]);
+        g_free (bname);
+    }
+
+    // every translated entry must have a matching entry in the base file
+    for (i = 0; base && i < n_locs; i++)
+    {
+        for (j = 0; j < locs[i]->len; j++)
+        {
+            le = g_ptr_array_index (locs[i], j);
+            for (k = 0; k < base->len; k++)
+                if (!g_strcmp0 (((Entry *) g_ptr_array_index (base, k))->str[CF_GROUP], le->str[CF_GROUP])) break;
+            if (k == base->len) fail (langs[i], le->str[CF_GROUP], "not present in %s", argv[first]);
+        }
+    }
+
+    if (errors || !base)
+    {
+        fprintf (stderr, "%d error(s) - catalog not written\n", errors);
+        return 1;
+    }
+
+    return write_catalog (output, base, locs, langs, n_locs) ? 0 : 1;
+}
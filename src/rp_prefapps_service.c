@@ -0,0 +1,711 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* rp-prefapps-service - resident cache of resolved catalog packages, shared between clients
+ *
+ * Clients send the names they need resolved; the results are kept, and re-resolved in the background
+ * whenever dpkg or PackageKit report a change, so later requests are answered straight from memory.
+ * The protocol is described in prefapps_service.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <grp.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "prefapps.h"
+#include "prefapps_service.h"
+
+/* A refresh younger than this, in seconds, is shared with clients which ask for another */
+
+#define REFRESH_AGE         1800
+
+/* Delay after a change notification before re-resolving, so a burst of changes causes one rescan */
+
+#define CHANGE_DELAY        2
+
+/* Limits on what one client can make the service hold - the length of a request line, the names or IDs in
+ * one request, and the numbers of names and details kept, beyond which the oldest are dropped */
+
+#define READ_SIZE           4096
+#define MAX_LINE            65536
+#define MAX_NAMES           1024
+#define MAX_KNOWN           4096
+#define MAX_DETAILS         4096
+
+/* Group allowed to connect, as well as root, when the socket is not passed in by systemd */
+
+#define SOCKET_GROUP        "sudo"
+
+typedef struct {
+    GSocketConnection *conn;
+    GInputStream *in;
+    GOutputStream *out;
+    GString *line;
+    gchar chunk[READ_SIZE];
+    gchar **names;
+} Client;
+
+PkClient *pk;
+PkControl *control;
+GFileMonitor *dpkg_mon;
+GMainLoop *loop;
+
+GHashTable *resolved;       /* name -> GPtrArray of reply lines; present once the name has been resolved */
+GHashTable *known;          /* every name asked for, re-resolved whenever the package state changes */
+GHashTable *details;        /* package ID -> DETAIL reply line; IDs include the version, so these never go stale */
+GQueue *known_order;        /* names in known, oldest first, for dropping once there are too many */
+GQueue *details_order;      /* IDs in details, oldest first */
+GList *waiting;             /* clients whose RESOLVE needs names not yet in the cache */
+GList *refreshing;          /* clients waiting for the refresh in progress */
+gboolean resolving, stale, refresh_running;
+gint64 last_refresh;
+guint change_timer;
+
+static void client_read (Client *c);
+static void client_data (GObject *src, GAsyncResult *res, gpointer data);
+static gboolean client_line (gpointer data);
+static void client_free (Client *c);
+static void reply (Client *c, const gchar *text);
+static gboolean check_request (Client *c, gchar **args, gboolean ids);
+static void known_add (const gchar *name);
+static void details_add (const gchar *id, const gchar *line);
+static void handle_resolve (Client *c, gchar **names);
+static gboolean try_resolve (Client *c);
+static void start_resolve (void);
+static void resolve_done (GObject *src, GAsyncResult *res, gpointer data);
+static void handle_details (Client *c, gchar **ids);
+static void details_done (GObject *src, GAsyncResult *res, gpointer data);
+static void send_details (Client *c);
+static void handle_refresh (Client *c);
+static void refresh_done (GObject *src, GAsyncResult *res, gpointer data);
+static gchar *error_line (GError *error, PkError *pkerror);
+static void state_changed (void);
+static void pk_changed (PkControl *control, gpointer data);
+static gboolean rescan (gpointer data);
+static void dpkg_changed (GFileMonitor *mon, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data);
+static gboolean incoming (GSocketService *service, GSocketConnection *conn, GObject *source, gpointer data);
+static GSocketService *create_service (void);
+
+/*----------------------------------------------------------------------------*/
+/* Client connections                                                         */
+/*----------------------------------------------------------------------------*/
+
+static void client_read (Client *c)
+{
+    // one request at a time - the next line is only read once the reply to this one has been sent; a line which
+    // arrived with an earlier one is handled from idle, so a client sending many at once can't deepen the stack
+    if (memchr (c->line->str, '\n', c->line->len))
+    {
+        g_idle_add (client_line, c);
+        return;
+    }
+
+    // the line is read in chunks, so a client which never sends a newline can only make it grow so far
+    if (c->line->len > MAX_LINE)
+    {
+        reply (c, "ERROR request too long\n");
+        client_free (c);
+        return;
+    }
+    g_input_stream_read_async (c->in, c->chunk, READ_SIZE, G_PRIORITY_DEFAULT, NULL, client_data, c);
+}
+
+static void client_data (GObject *src, GAsyncResult *res, gpointer data)
+{
+    Client *c = (Client *) data;
+    gssize len;
+
+    len = g_input_stream_read_finish (c->in, res, NULL);
+    if (len <= 0)
+    {
+        // closed by the client, or failed
+        client_free (c);
+        return;
+    }
+    g_string_append_len (c->line, c->chunk, len);
+    client_read (c);
+}
+
+static gboolean client_line (gpointer data)
+{
+    Client *c = (Client *) data;
+    gchar *line, *end, **args;
+
+    end = memchr (c->line->str, '\n', c->line->len);
+    line = g_strndup (c->line->str, end - c->line->str);
+    g_string_erase (c->line, 0, end - c->line->str + 1);
+
+    g_strstrip (line);
+    args = g_strsplit_set (line, " \t", -1);
+    if (!g_strcmp0 (args[0], "RESOLVE"))
+    {
+        handle_resolve (c, g_strdupv (args + 1));
+    }
+    else if (!g_strcmp0 (args[0], "DETAILS"))
+    {
+        handle_details (c, g_strdupv (args + 1));
+    }
+    else if (!g_strcmp0 (args[0], "REFRESH"))
+    {
+        handle_refresh (c);
+    }
+    else
+    {
+        reply (c, "ERROR unknown request\n");
+        client_read (c);
+    }
+    g_strfreev (args);
+    g_free (line);
+    return FALSE;
+}
+
+static void client_free (Client *c)
+{
+    g_strfreev (c->names);
+    g_string_free (c->line, TRUE);
+    g_object_unref (c->conn);
+    g_free (c);
+}
+
+static void reply (Client *c, const gchar *text)
+{
+    // replies are short and the clients are local, so a blocking write is fine; a failure shows up as EOF on the next read
+    g_output_stream_write_all (c->out, text, strlen (text), NULL, NULL, NULL);
+}
+
+static gboolean check_request (Client *c, gchar **args, gboolean ids)
+{
+    gchar *name;
+    const gchar *msg = NULL;
+    int i;
+
+    // anything which could not be a package, or a package ID, is refused rather than passed on to PackageKit
+    if (g_strv_length (args) > MAX_NAMES) msg = "ERROR too many names\n";
+    for (i = 0; args[i] && !msg; i++)
+    {
+        if (!*args[i]) continue;
+        if (ids)
+        {
+            name = g_strndup (args[i], strcspn (args[i], ";"));
+            if (!prefapps_valid_name (name) || !pk_package_id_check (args[i])) msg = "ERROR invalid package ID\n";
+            g_free (name);
+        }
+        else if (!prefapps_valid_name (args[i])) msg = "ERROR invalid package name\n";
+    }
+    if (!msg) return TRUE;
+
+    reply (c, msg);
+    g_strfreev (args);
+    client_read (c);
+    return FALSE;
+}
+
+static void known_add (const gchar *name)
+{
+    gchar *key, *old;
+
+    if (g_hash_table_contains (known, name)) return;
+    key = g_strdup (name);
+    g_hash_table_add (known, key);
+    g_queue_push_tail (known_order, key);
+
+    // the oldest names are forgotten - a client still waiting for one has it resolved again by start_resolve
+    while (known_order->length > MAX_KNOWN)
+    {
+        old = g_queue_pop_head (known_order);
+        g_hash_table_remove (resolved, old);
+        g_hash_table_remove (known, old);
+    }
+}
+
+static void details_add (const gchar *id, const gchar *line)
+{
+    gchar *key;
+
+    // an ID already held keeps its key, which is the one in details_order
+    if (g_hash_table_contains (details, id))
+    {
+        g_hash_table_insert (details, g_strdup (id), g_strdup (line));
+        return;
+    }
+    key = g_strdup (id);
+    g_hash_table_insert (details, key, g_strdup (line));
+    g_queue_push_tail (details_order, key);
+    while (details_order->length > MAX_DETAILS) g_hash_table_remove (details, g_queue_pop_head (details_order));
+}
+
+/*----------------------------------------------------------------------------*/
+/* Resolving                                                                  */
+/*----------------------------------------------------------------------------*/
+
+static void handle_resolve (Client *c, gchar **names)
+{
+    int i;
+
+    if (!check_request (c, names, FALSE)) return;
+    c->names = names;
+    for (i = 0; names[i]; i++)
+        if (*names[i]) known_add (names[i]);
+
+    if (!try_resolve (c))
+    {
+        waiting = g_list_append (waiting, c);
+        if (!resolving) start_resolve ();
+    }
+}
+
+static gboolean try_resolve (Client *c)
+{
+    GString *buf;
+    GPtrArray *lines;
+    int i, j;
+
+    // answer the request if every name in it is in the cache
+    for (i = 0; c->names[i]; i++)
+        if (*c->names[i] && !g_hash_table_contains (resolved, c->names[i])) return FALSE;
+
+    buf = g_string_new (NULL);
+    for (i = 0; c->names[i]; i++)
+    {
+        lines = g_hash_table_lookup (resolved, c->names[i]);
+        for (j = 0; lines && j < lines->len; j++) g_string_append (buf, g_ptr_array_index (lines, j));
+    }
+    g_string_append (buf, "END\n");
+    reply (c, buf->str);
+    g_string_free (buf, TRUE);
+
+    g_strfreev (c->names);
+    c->names = NULL;
+    client_read (c);
+    return TRUE;
+}
+
+static void start_resolve (void)
+{
+    GHashTableIter iter;
+    GHashTable *want;
+    GPtrArray *names;
+    GList *l;
+    gpointer name;
+    int i;
+
+    // everything known which is not in the cache, for warming after a change, and whatever waiting clients still
+    // need - which may have been dropped from known if other clients have asked for many names since
+    want = g_hash_table_new (g_str_hash, g_str_equal);
+    g_hash_table_iter_init (&iter, known);
+    while (g_hash_table_iter_next (&iter, &name, NULL))
+        if (!g_hash_table_contains (resolved, name)) g_hash_table_add (want, name);
+    for (l = waiting; l; l = l->next)
+        for (i = 0; ((Client *) l->data)->names[i]; i++)
+            if (*((Client *) l->data)->names[i] && !g_hash_table_contains (resolved, ((Client *) l->data)->names[i]))
+                g_hash_table_add (want, ((Client *) l->data)->names[i]);
+
+    names = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_iter_init (&iter, want);
+    while (g_hash_table_iter_next (&iter, &name, NULL)) g_ptr_array_add (names, g_strdup (name));
+    g_hash_table_destroy (want);
+    if (!names->len)
+    {
+        g_ptr_array_free (names, TRUE);
+        return;
+    }
+    g_ptr_array_add (names, NULL);
+
+    resolving = TRUE;
+    stale = FALSE;
+    pk_client_resolve_async (pk, 0, (gchar **) names->pdata, NULL, NULL, NULL, resolve_done, names);
+}
+
+static void resolve_done (GObject *src, GAsyncResult *res, gpointer data)
+{
+    GPtrArray *names = (GPtrArray *) data, *array, *lines;
+    PkResults *results;
+    PkError *pkerror = NULL;
+    PkPackage *item;
+    GError *error = NULL;
+    GList *l, *next;
+    gchar *buf;
+    int i;
+
+    resolving = FALSE;
+    results = pk_client_generic_finish (pk, res, &error);
+    if (results) pkerror = pk_results_get_error_code (results);
+
+    if (error || pkerror)
+    {
+        // fail every waiting request; the cache is left as it was, so the next request will try again
+        buf = error_line (error, pkerror);
+        for (l = waiting; l; l = l->next)
+        {
+            reply (l->data, buf);
+            g_strfreev (((Client *) l->data)->names);
+            ((Client *) l->data)->names = NULL;
+            client_read (l->data);
+        }
+        g_list_free (waiting);
+        waiting = NULL;
+        g_free (buf);
+        if (error) g_error_free (error);
+        if (pkerror) g_object_unref (pkerror);
+        if (results) g_object_unref (results);
+        g_ptr_array_free (names, TRUE);
+        return;
+    }
+
+    if (!stale)
+    {
+        // every name asked for gets an entry, even if nothing was found for it; each is known, so counts towards the limit
+        for (i = 0; i < names->len - 1; i++)
+        {
+            known_add (g_ptr_array_index (names, i));
+            g_hash_table_insert (resolved, g_strdup (g_ptr_array_index (names, i)), g_ptr_array_new_with_free_func (g_free));
+        }
+
+        array = pk_results_get_package_array (results);
+        for (i = 0; i < array->len; i++)
+        {
+            item = g_ptr_array_index (array, i);
+            lines = g_hash_table_lookup (resolved, pk_package_get_name (item));
+            if (lines) g_ptr_array_add (lines, g_strdup_printf ("PACKAGE %d %s\n", pk_package_get_info (item), pk_package_get_id (item)));
+        }
+        g_ptr_array_unref (array);
+    }
+    g_object_unref (results);
+    g_ptr_array_free (names, TRUE);
+
+    // answer whatever can now be answered; anything else, or a change during the resolve, needs another pass
+    for (l = waiting; l; l = next)
+    {
+        next = l->next;
+        if (try_resolve (l->data)) waiting = g_list_delete_link (waiting, l);
+    }
+    if (waiting || stale) start_resolve ();
+}
+
+/*----------------------------------------------------------------------------*/
+/* Details                                                                    */
+/*----------------------------------------------------------------------------*/
+
+static void handle_details (Client *c, gchar **ids)
+{
+    GPtrArray *missing;
+    int i;
+
+    if (!check_request (c, ids, TRUE)) return;
+    c->names = ids;
+    missing = g_ptr_array_new ();
+    for (i = 0; ids[i]; i++)
+        if (*ids[i] && !g_hash_table_contains (details, ids[i])) g_ptr_array_add (missing, ids[i]);
+
+    if (missing->len)
+    {
+        g_ptr_array_add (missing, NULL);
+        pk_client_get_details_async (pk, (gchar **) missing->pdata, NULL, NULL, NULL, details_done, c);
+    }
+    else send_details (c);
+    g_ptr_array_free (missing, TRUE);
+}
+
+static void details_done (GObject *src, GAsyncResult *res, gpointer data)
+{
+    Client *c = (Client *) data;
+    PkResults *results;
+    PkError *pkerror = NULL;
+    PkDetails *item;
+    GPtrArray *array;
+    GError *error = NULL;
+    gchar *buf;
+    int i;
+
+    results = pk_client_generic_finish (pk, res, &error);
+    if (results) pkerror = pk_results_get_error_code (results);
+
+    if (error || pkerror)
+    {
+        buf = error_line (error, pkerror);
+        reply (c, buf);
+        g_free (buf);
+        g_strfreev (c->names);
+        c->names = NULL;
+        client_read (c);
+        if (error) g_error_free (error);
+        if (pkerror) g_object_unref (pkerror);
+        if (results) g_object_unref (results);
+        return;
+    }
+
+    // the reply lines are kept ready to send, keyed by package ID
+    array = pk_results_get_details_array (results);
+    for (i = 0; i < array->len; i++)
+    {
+        item = g_ptr_array_index (array, i);
+        buf = prefapps_details_line (item);
+        details_add (pk_details_get_package_id (item), buf);
+        g_free (buf);
+    }
+    g_ptr_array_unref (array);
+    g_object_unref (results);
+
+    // an ID with nothing to report is remembered too, so it isn't asked for every time
+    for (i = 0; c->names[i]; i++)
+        if (*c->names[i] && !g_hash_table_contains (details, c->names[i])) details_add (c->names[i], "");
+
+    send_details (c);
+}
+
+static void send_details (Client *c)
+{
+    GString *buf;
+    const gchar *line;
+    int i;
+
+    // a request for more IDs than are kept may have had some of its own dropped already; those are left out
+    buf = g_string_new (NULL);
+    for (i = 0; c->names[i]; i++)
+    {
+        line = *c->names[i] ? g_hash_table_lookup (details, c->names[i]) : NULL;
+        if (line) g_string_append (buf, line);
+    }
+    g_string_append (buf, "END\n");
+    reply (c, buf->str);
+    g_string_free (buf, TRUE);
+
+    g_strfreev (c->names);
+    c->names = NULL;
+    client_read (c);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Refreshing                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static void handle_refresh (Client *c)
+{
+    if (!refresh_running && last_refresh && g_get_monotonic_time () / G_USEC_PER_SEC - last_refresh < REFRESH_AGE)
+    {
+        reply (c, "END\n");
+        client_read (c);
+        return;
+    }
+
+    refreshing = g_list_append (refreshing, c);
+    if (!refresh_running)
+    {
+        refresh_running = TRUE;
+        pk_client_refresh_cache_async (pk, FALSE, NULL, NULL, NULL, refresh_done, NULL);
+    }
+}
+
+static void refresh_done (GObject *src, GAsyncResult *res, gpointer data)
+{
+    PkResults *results;
+    PkError *pkerror = NULL;
+    GError *error = NULL;
+    GList *l;
+    gchar *buf;
+
+    refresh_running = FALSE;
+    results = pk_client_generic_finish (pk, res, &error);
+    if (results) pkerror = pk_results_get_error_code (results);
+
+    if (error || pkerror) buf = error_line (error, pkerror);
+    else
+    {
+        buf = g_strdup ("END\n");
+        last_refresh = g_get_monotonic_time () / G_USEC_PER_SEC;
+        state_changed ();
+    }
+
+    for (l = refreshing; l; l = l->next)
+    {
+        reply (l->data, buf);
+        client_read (l->data);
+    }
+    g_list_free (refreshing);
+    refreshing = NULL;
+
+    g_free (buf);
+    if (error) g_error_free (error);
+    if (pkerror) g_object_unref (pkerror);
+    if (results) g_object_unref (results);
+}
+
+static gchar *error_line (GError *error, PkError *pkerror)
+{
+    gchar *msg, *buf;
+
+    // the description must stay on one line
+    msg = g_strdup (error ? error->message : pk_error_get_details (pkerror));
+    g_strdelimit (msg, "\r\n", ' ');
+    buf = g_strdup_printf ("ERROR %s\n", msg);
+    g_free (msg);
+    return buf;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Change notification                                                        */
+/*----------------------------------------------------------------------------*/
+
+static void state_changed (void)
+{
+    if (change_timer) g_source_remove (change_timer);
+    change_timer = g_timeout_add_seconds (CHANGE_DELAY, rescan, NULL);
+}
+
+static void pk_changed (PkControl *control, gpointer data)
+{
+    state_changed ();
+}
+
+static gboolean rescan (gpointer data)
+{
+    // drop the cache and resolve everything known again, so the next client finds it warm
+    change_timer = 0;
+    g_hash_table_remove_all (resolved);
+    if (resolving) stale = TRUE;
+    else start_resolve ();
+    return FALSE;
+}
+
+static void dpkg_changed (GFileMonitor *mon, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data)
+{
+    if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT || event == G_FILE_MONITOR_EVENT_CREATED) state_changed ();
+}
+
+/*----------------------------------------------------------------------------*/
+/* Socket                                                                     */
+/*----------------------------------------------------------------------------*/
+
+static gboolean incoming (GSocketService *service, GSocketConnection *conn, GObject *source, gpointer data)
+{
+    Client *c;
+
+    c = g_new0 (Client, 1);
+    c->conn = g_object_ref (conn);
+    c->in = g_io_stream_get_input_stream (G_IO_STREAM (conn));
+    c->line = g_string_new (NULL);
+    c->out = g_io_stream_get_output_stream (G_IO_STREAM (conn));
+    client_read (c);
+    return TRUE;
+}
+
+static GSocketService *create_service (void)
+{
+    GSocketService *service;
+    GSocketAddress *addr;
+    GSocket *sock;
+    GError *error = NULL;
+    const gchar *fds, *pid;
+    struct group *grp;
+    gchar *dir;
+
+    service = g_socket_service_new ();
+
+    // use the socket passed in by systemd if there is one, otherwise create it
+    fds = g_getenv ("LISTEN_FDS");
+    pid = g_getenv ("LISTEN_PID");
+    if (fds && pid && atoi (fds) == 1 && atoi (pid) == getpid ())
+    {
+        sock = g_socket_new_from_fd (3, &error);
+        if (sock)
+        {
+            g_socket_listener_add_socket (G_SOCKET_LISTENER (service), sock, NULL, &error);
+            g_object_unref (sock);
+        }
+    }
+    else
+    {
+        dir = g_path_get_dirname (SERVICE_SOCKET);
+        g_mkdir_with_parents (dir, 0755);
+        g_free (dir);
+        g_unlink (SERVICE_SOCKET);
+        addr = g_unix_socket_address_new (SERVICE_SOCKET);
+        if (g_socket_listener_add_address (G_SOCKET_LISTENER (service), addr, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error))
+        {
+            // the same access as rp-prefapps.socket gives - root, and the administrators' group
+            grp = getgrnam (SOCKET_GROUP);
+            if (grp && chown (SERVICE_SOCKET, 0, grp->gr_gid)) grp = NULL;
+            g_chmod (SERVICE_SOCKET, grp ? 0660 : 0600);
+        }
+        g_object_unref (addr);
+    }
+
+    if (error)
+    {
+        g_printerr ("rp-prefapps-service: %s\n", error->message);
+        g_error_free (error);
+        g_object_unref (service);
+        return NULL;
+    }
+    return service;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function                                                              */
+/*----------------------------------------------------------------------------*/
+
+int main (int argc, char *argv[])
+{
+    GSocketService *service;
+    GFile *status;
+
+    service = create_service ();
+    if (!service) return 1;
+
+    pk = pk_client_new ();
+    resolved = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+    known = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    details = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    known_order = g_queue_new ();
+    details_order = g_queue_new ();
+
+    // anything which may change what is installed or available invalidates the cache
+    control = pk_control_new ();
+    g_signal_connect (control, "updates-changed", G_CALLBACK (pk_changed), NULL);
+    g_signal_connect (control, "repo-list-changed", G_CALLBACK (pk_changed), NULL);
+    status = g_file_new_for_path ("/var/lib/dpkg/status");
+    dpkg_mon = g_file_monitor_file (status, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (dpkg_mon) g_signal_connect (dpkg_mon, "changed", G_CALLBACK (dpkg_changed), NULL);
+    g_object_unref (status);
+
+    g_signal_connect (service, "incoming", G_CALLBACK (incoming), NULL);
+    g_socket_service_start (service);
+
+    loop = g_main_loop_new (NULL, FALSE);
+    g_main_loop_run (loop);
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*
+Copyright (c) 2018 Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "prefapps.h"
+
+/* Repeats the work done each time the application loads its list - loading the catalog and local fragments,
+ * resolving the package names, choosing IDs, reading their details both directly and through the catalog
+ * service's DETAIL lines, and building the install and remove sets - and fails if the heap or the peak
+ * resident size has grown between the first and the last cycle. The resolver and the details are stubs which
+ * return fixed packages, so the test needs neither PackageKit nor a package cache. Filling and swapping the
+ * GTK list stores needs a display, so that part of a reload is not covered. */
+
+/* Number of load cycles, and the growth allowed between the first and last of them */
+
+#define CYCLES              200
+#define HEAP_SLACK          (256 * 1024)
+#define HWM_SLACK           (1024 * 1024)
+
+static gsize heap_used (void);
+static gsize peak_rss (void);
+static GPtrArray *stub_resolve (GPtrArray *pnames);
+static GPtrArray *stub_details (GHashTable *best);
+static void read_details (GHashTable *best);
+static void cycle (void);
+static void remove_tree (const gchar *path);
+
+/*----------------------------------------------------------------------------*/
+/* Measurement                                                                */
+/*----------------------------------------------------------------------------*/
+
+static gsize heap_used (void)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2 ();
+#else
+    struct mallinfo mi = mallinfo ();
+#endif
+    return mi.uordblks;
+}
+
+static gsize peak_rss (void)
+{
+    gchar *buf, *line;
+    gsize kb = 0;
+
+    // VmHWM is the high water mark of the resident set, in kB
+    if (!g_file_get_contents ("/proc/self/status", &buf, NULL, NULL)) return 0;
+    line = strstr (buf, "VmHWM:");
+    if (line) kb = g_ascii_strtoull (line + 6, NULL, 10);
+    g_free (buf);
+    return kb * 1024;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Load cycle                                                                 */
+/*----------------------------------------------------------------------------*/
+
+static GPtrArray *stub_resolve (GPtrArray *pnames)
+{
+    GPtrArray *packages;
+    PkPackage *pkg;
+    gchar *id;
+    int i;
+
+    // every name has an armhf and an arm64 version; every third one is installed
+    packages = g_ptr_array_new_with_free_func (g_object_unref);
+    for (i = 0; i < pnames->len; i++)
+    {
+        pkg = pk_package_new ();
+        id = g_strdup_printf ("%s;1.0;armhf;raspbian", (gchar *) g_ptr_array_index (pnames, i));
+        pk_package_set_id (pkg, id, NULL);
+        g_object_set (pkg, "info", i % 3 ? PK_INFO_ENUM_AVAILABLE : PK_INFO_ENUM_INSTALLED, NULL);
+        g_ptr_array_add (packages, pkg);
+        g_free (id);
+
+        pkg = pk_package_new ();
+        id = g_strdup_printf ("%s;1.0;arm64;raspbian", (gchar *) g_ptr_array_index (pnames, i));
+        pk_package_set_id (pkg, id, NULL);
+        g_object_set (pkg, "info", PK_INFO_ENUM_AVAILABLE, NULL);
+        g_ptr_array_add (packages, pkg);
+        g_free (id);
+    }
+    return packages;
+}
+
+static GPtrArray *stub_details (GHashTable *best)
+{
+    GHashTableIter iter;
+    GPtrArray *details;
+    PkDetails *item;
+    gpointer name, id;
+    gchar *sum, *desc;
+
+    // a summary and a multi-line description with characters which need escaping, for each chosen ID
+    details = g_ptr_array_new_with_free_func (g_object_unref);
+    g_hash_table_iter_init (&iter, best);
+    while (g_hash_table_iter_next (&iter, &name, &id))
+    {
+        sum = g_strdup_printf ("Summary of %s", (gchar *) name);
+        desc = g_strdup_printf ("The \"%s\" package.\n\n\tIt has <markup> & tabs.", (gchar *) name);
+        item = pk_details_new ();
+        g_object_set (item, "package-id", id, "summary", sum, "description", desc, NULL);
+        g_ptr_array_add (details, item);
+        g_free (sum);
+        g_free (desc);
+    }
+    return details;
+}
+
+static void read_details (GHashTable *best)
+{
+    GPtrArray *details, *lines;
+    GHashTable *direct, *parsed;
+    GHashTableIter iter;
+    PkDetails *item;
+    gpointer name, text;
+    const gchar *id;
+    gchar *line, *desc;
+    int i;
+
+    // as the application reads them from PackageKit, and as the service sends them and the application reads them back
+    details = stub_details (best);
+    direct = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    lines = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < details->len; i++)
+    {
+        item = g_ptr_array_index (details, i);
+        id = pk_details_get_package_id (item);
+        desc = prefapps_details_text (pk_details_get_summary (item), pk_details_get_description (item));
+        g_hash_table_replace (direct, g_strndup (id, strcspn (id, ";")), desc);
+
+        // the client reads the line without its newline
+        line = prefapps_details_line (item);
+        line[strcspn (line, "\n")] = 0;
+        g_ptr_array_add (lines, line);
+    }
+    parsed = prefapps_details_parse (lines);
+
+    // both ways must give the same text, or the escaping has been done twice or not at all
+    g_hash_table_iter_init (&iter, direct);
+    while (g_hash_table_iter_next (&iter, &name, &text))
+    {
+        if (g_strcmp0 (text, g_hash_table_lookup (parsed, name)))
+        {
+            g_printerr ("details for %s differ when read through the service\n", (gchar *) name);
+            exit (1);
+        }
+    }
+
+    g_hash_table_destroy (parsed);
+    g_hash_table_destroy (direct);
+    g_ptr_array_free (lines, TRUE);
+    g_ptr_array_free (details, TRUE);
+}
+
+static void cycle (void)
+{
+    Catalog *cat;
+    CatEntry *e;
+    GPtrArray *pnames, *packages, *inst, *uninst;
+    GHashTable *best;
+    gchar *lang, *lang_loc;
+    const gchar *id;
+    int i;
+
+    cat = prefapps_catalog_load ("en");
+    if (!cat)
+    {
+        g_printerr ("catalog could not be loaded\n");
+        exit (1);
+    }
+
+    prefapps_get_locales (&lang, &lang_loc);
+    pnames = g_ptr_array_new ();
+    for (i = 0; i < cat->entries->len; i++)
+    {
+        e = g_ptr_array_index (cat->entries, i);
+        if (e->flags & ENTRY_HIDDEN) continue;
+        prefapps_entry_names (cat, e, lang, lang_loc, pnames);
+    }
+
+    packages = stub_resolve (pnames);
+    best = prefapps_best_ids (packages);
+    read_details (best);
+
+    // select every entry which is not installed and deselect every one which is, so both sets are built
+    inst = g_ptr_array_new_with_free_func (g_free);
+    uninst = g_ptr_array_new_with_free_func (g_free);
+    for (i = 0; i < cat->entries->len; i++)
+    {
+        e = g_ptr_array_index (cat->entries, i);
+        if (e->flags & ENTRY_HIDDEN) continue;
+        id = g_hash_table_lookup (best, e->str[CF_PACKAGE]);
+        if (!id) continue;
+        prefapps_selection_add (inst, uninst, i % 3 == 0, i % 3 != 0, id,
+            e->str[CF_RPACKAGE] ? g_hash_table_lookup (best, e->str[CF_RPACKAGE]) : NULL, "none");
+    }
+
+    g_ptr_array_free (inst, TRUE);
+    g_ptr_array_free (uninst, TRUE);
+    g_hash_table_destroy (best);
+    g_ptr_array_free (packages, TRUE);
+    g_ptr_array_free (pnames, TRUE);
+    g_free (lang);
+    g_free (lang_loc);
+    prefapps_catalog_free (cat);
+}
+
+static void remove_tree (const gchar *path)
+{
+    GDir *dir;
+    const gchar *name;
+    gchar *buf;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (dir)
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            buf = g_build_filename (path, name, NULL);
+            remove_tree (buf);
+            g_free (buf);
+        }
+        g_dir_close (dir);
+    }
+    g_remove (path);
+}
+
+/*----------------------------------------------------------------------------*/
+/* Main function                                                              */
+/*----------------------------------------------------------------------------*/
+
+int main (int argc, char *argv[])
+{
+    gchar *cache;
+    gsize heap, hwm, heap_end, hwm_end;
+    int i, ret = 0;
+
+    // the fragment cache goes in a scratch directory, so the test can run unprivileged from the build tree
+    cache = g_dir_make_tmp ("rp-prefapps-XXXXXX", NULL);
+    if (!cache)
+    {
+        g_printerr ("cache directory could not be created\n");
+        return 1;
+    }
+    prefapps_set_dirs (TEST_DATA_DIR, TEST_CONF_DIR, cache);
+
+    // the first cycle fills the fragment cache and registers the types, so it is the baseline
+    cycle ();
+    heap = heap_used ();
+    hwm = peak_rss ();
+
+    for (i = 1; i < CYCLES; i++) cycle ();
+    heap_end = heap_used ();
+    hwm_end = peak_rss ();
+
+    g_print ("heap %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT ", peak rss %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT "\n",
+        heap, heap_end, hwm, hwm_end);
+    if (heap_end > heap + HEAP_SLACK)
+    {
+        g_printerr ("heap grew by %" G_GSIZE_FORMAT " bytes over %d cycles\n", heap_end - heap, CYCLES);
+        ret = 1;
+    }
+    if (hwm_end > hwm + HWM_SLACK)
+    {
+        g_printerr ("peak rss grew by %" G_GSIZE_FORMAT " bytes over %d cycles\n", hwm_end - hwm, CYCLES);
+        ret = 1;
+    }
+
+    remove_tree (cache);
+    g_free (cache);
+    return ret;
+}